@@ -243,6 +243,24 @@ void Panel::draw()
     glMatrixMode(GL_MODELVIEW); 
 }
 
+void Panel::ray(int x, int y, glm::vec3& origin, glm::vec3& direction)
+{
+    // undo draw()'s camera: translate(0, 0, -tz) * translate(tx, ty, 0) * rotate(phi, x axis) * rotate(the, y axis)
+    float h = tan(glm::radians(45.0f) / 2);
+    glm::vec3 eye(0, 0, 0);
+    glm::vec3 toward((2.0f * x / getWidth() - 1) * h * getWidth() / getHeight(), (1 - 2.0f * y / getHeight()) * h, -1);
+    float cPhi = cos(glm::radians(_camera->getPhi())), sPhi = sin(glm::radians(_camera->getPhi()));
+    float cThe = cos(glm::radians(_camera->getThe())), sThe = sin(glm::radians(_camera->getThe()));
+    auto toWorld = [&](glm::vec3 p, bool point)
+    {
+        if (point) p -= glm::vec3(_camera->getTx(), _camera->getTy(), -_camera->getTz());
+        p = glm::vec3(p[0], cPhi * p[1] + sPhi * p[2], -sPhi * p[1] + cPhi * p[2]);
+        return glm::vec3(cThe * p[0] - sThe * p[2], p[1], sThe * p[0] + cThe * p[2]);
+    };
+    origin = toWorld(eye, true);
+    direction = glm::normalize(toWorld(toward, false));
+}
+
 /** Button Class **/
 /** Abstract class that defines the basic properties of an UI element
  *
@@ -281,6 +299,12 @@ void Controls::Mouse::_mouse(int button, int state, int x, int y)
     {
     case GLUT_LEFT_BUTTON:
         _buttons[0] = ((GLUT_DOWN==state)? true : false);
+        if (_buttons[0])
+        {
+            _downx = x;
+            _downy = y;
+        }
+        else if (x == _downx && y == _downy) _pick(x, y); // a click rather than a drag
         //std::cout << "Left button pressed." << x << ", " << y << std::endl;
         break;
 
@@ -301,6 +325,21 @@ void Controls::Mouse::_mouse(int button, int state, int x, int y)
     glutPostRedisplay();
 }
 
+void Controls::Mouse::_pick(int x, int y)
+{
+    if (_meshObject == NULL || _meshObject->simplifying() == true) return; // the worker owns the mesh while it runs
+    glm::vec3 origin, direction;
+    _panel->ray(x, y, origin, direction);
+    glm::mat4 toModel = glm::inverse(_meshObject->modelMatrix());
+    origin = glm::vec3(toModel * glm::vec4(origin, 1));
+    direction = glm::vec3(toModel * glm::vec4(direction, 0));
+    int v = _meshObject->pickVertex(origin, direction);
+    if (v == -1) return;
+    glm::vec3 p = _meshObject->vertexPositions()[v];
+    printf("Picked vertex %i at (%g, %g, %g)\n", v, p[0], p[1], p[2]);
+    _meshObject->setVertexColor(v, glm::vec4(1, 0, 0, 1));
+}
+
 void Controls::Mouse::_motion(int x, int y)
 {
     int diffxlast = _lastx - _lastlastx;
@@ -163,6 +163,7 @@ public:
 
     Scene::Camera * getCamera() { return _camera; }
     Scene::MeshObject * getMeshObject() { return _meshObject; }
+    void ray(int x, int y, glm::vec3& origin, glm::vec3& direction); // world-space ray through window pixel (x, y), as draw() places the camera
 private:
     std::vector<Button> _buttons;
     bool _persp;
@@ -200,8 +201,7 @@ namespace Controls
     {
     public:
         //TODO replace with actual camera?
-        Mouse(Panel * panel, Scene::Camera * camera, Scene::MeshObject * meshObject) : _panel(panel), _camera(camera) { init(); }
-        //Mouse(Panel * panel, Scene::Camera * camera, Scene::MeshObject * meshObject) : _panel(panel), _camera(camera), _meshObject(meshObject) { init(); }
+        Mouse(Panel * panel, Scene::Camera * camera, Scene::MeshObject * meshObject) : _panel(panel), _camera(camera), _meshObject(meshObject) { init(); }
         void init();
 
     private:
@@ -210,8 +210,10 @@ namespace Controls
         Scene::MeshObject * _meshObject;
         int _lastx, _lasty;
         int _lastlastx, _lastlasty;
+        int _downx, _downy; // where the left button went down. released there, it picks a vertex
         bool _buttons[3];
 
+        void _pick(int x, int y);
         void _mouse(int button, int state, int x, int y);
         void _motion(int x, int y);
         //TODO Mousewheel!
@@ -53,6 +53,31 @@ void SaveAsBMP(const char *fileName)
 GlutUI::Manager MANAGER;
 int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") { // RenderWindow --benchmark [results.json] [largest face count]. no window
+        int largest = argc > 3 ? atoi(argv[3]) : 1000000;
+        std::vector<int> sizes;
+        for (long long n = 1000; n <= largest; n *= 10) sizes.push_back(n); // long long, so the step past a large limit can't wrap
+        Scene::benchmarkPipeline(sizes, argc > 2 ? argv[2] : "benchmark.json");
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--check") { // RenderWindow --check. simplification, instancing and cluster LOD checks on generated meshes, no window. exits with 1 on a failure
+        bool passed = true;
+        for (int nFaces : { 64, 2048 }) { // the larger fan puts 1024 slivers around each apex
+            std::vector<glm::vec3> positions;
+            std::vector<int> indices;
+            Scene::makeFan(nFaces, positions, indices);
+            if (Scene::checkSimplify(positions, indices) == false) passed = false;
+        }
+        std::vector<glm::vec3> positions;
+        std::vector<int> indices;
+        Scene::makeIcosphere(1280, positions, indices);
+        if (Scene::checkInstance(positions, indices) == false) passed = false;
+        for (auto generate : { Scene::makeIcosphere, Scene::makeTerrain }) { // closed, and with a border
+            generate(20000, positions, indices);
+            if (Scene::checkClusterDAG(positions, indices) == false) passed = false;
+        }
+        return passed ? 0 : 1;
+    }
     MANAGER.init(argc, argv);
     int windowWidth = 256;
     int windowHeight = 256;
@@ -73,7 +98,9 @@ int main(int argc, char* argv[])
 
     Scene::MeshObject* meshObject = new Scene::MeshObject(fileName);
     world.assignShader(meshObject, rainbowShader);
+    meshObject->setCheckpointBudget(256 << 20); // lets large LOD jumps on .offpm files restore a snapshot instead of replaying collapses
     meshObject->readGeom();
+    if (meshObject->format() == "off") meshObject->streamCollapses();
     world.addObject(meshObject);
 
     float xMin = meshObject->xMin();
@@ -168,13 +195,21 @@ int main(int argc, char* argv[])
     int bmpCounter = 0;
     float complexityMultiplier = 1.0 / 32.0;
     float complexityIncrement = 1.0 / 16.0;
+    Scene::ClusterDAG dag; // built by 'k' on the simplifier's thread, so it has to outlive it
+    Scene::SimplifyWorker simplifier; // big simplifications run on it so the window keeps drawing
+    auto meshFree = [&]() { // the worker owns the mesh while it runs
+        if (meshObject->simplifying() == false) return true;
+        printf("Still simplifying (%.0f%%), 'h' cancels\n", 100 * simplifier.progress());
+        return false;
+    };
     auto alambda = [&]() {
+        if (meshFree() == false) return;
         if (meshObject->format() == "off") {
             meshObject->collapseRandomEdge(Scene::MIDPOINT_APPROXIMATION_METHOD);
         }
     };
     auto slambda = [&]() {
-        
+        if (meshFree() == false) return;
         if (meshObject->format() == "off") {
             int nVV = meshObject->nVisibleVertices();
             int n = fmax(1, nVV / 100);
@@ -183,50 +218,164 @@ int main(int argc, char* argv[])
         }
     };
     auto zlambda = [&]() {
+        if (meshFree() == false) return;
         if (meshObject->format() == "off"){
             meshObject->quadricSimplify();
         }
     };
     auto xlambda = [&]() {
-        if (meshObject->format() == "off") {
+        if (meshObject->format() == "off" && meshFree() == true) {
             int nCP = meshObject->nCollapsablePairs();
             int n = sqrt(nCP) / 2;
             if (n == 0) n = fmin(nCP, 1);
             printf("%i  ", n);
-            for (int i = 0; i < n; i++) {
-                meshObject->quadricSimplify();
-            }
+            simplifier.start(meshObject, n);
         }
     };
     auto nlambda = [&]() {
+        if (meshFree() == false) return;
         printf("Writing progressive mesh data to %s\n", meshObject->outFileName());
         meshObject->makeProgressiveMeshFile();
     };
-    auto mlambda = [&]() {
+    auto olambda = [&]() {
+        if (meshFree() == false) return;
+        std::string lodName = meshObject->inFileName();
+        lodName = lodName.substr(0, lodName.rfind('.')) + "_lod" + std::to_string(meshObject->nVisibleVertices()) + ".off";
+        meshObject->makeSimplifiedMeshFile(lodName);
+    };
+    auto llambda = [&]() {
+        if (meshFree() == false) return;
         if (meshObject->format() == "off") {
-            int collapseCount = 0;
-            for (int i = 0; i < meshObject->nVertices(); i++) {
-                if (collapseCount % 10 == 0) printf("Pairs Collapsed: %i\r", collapseCount);
-                meshObject->quadricSimplify();
-                collapseCount++;
-            }
-            //printf("Pairs Collapsed: %i\n", collapseCount);
-            printf("\nMaking Progressive Mesh File: %s\n", meshObject->outFileName());
-            meshObject->makeProgressiveMeshFile();
+            simplifier.start(meshObject, 0, [](Scene::MeshObject* mesh) { // the whole pass and the file writes on the worker, so the window keeps drawing
+                std::vector<float> fractions = { 1.0f, 0.5f, 0.25f, 0.125f, 0.0625f };
+                mesh->makeLODFiles(fractions);
+            });
+        }
+    };
+    auto clambda = [&]() {
+        printf("Objects drawn: %i, culled: %i. Draw calls: %i, state changes: %i\n", world.nDrawn(), world.nCulled(), world.queue().nDrawCalls(), world.queue().nStateChanges());
+        if (world.triangleBudget() > 0) printf("Triangles given out: %i of %i\n", world.nBudgetTriangles(), world.triangleBudget());
+        printf("Mesh uploads: %i bytes last frame, %.1f MB since loading\n", (int)meshObject->uploadedBytes(), meshObject->uploadedBytesTotal() / 1048576.0);
+    };
+    auto blambda = [&]() {
+        Scene::benchmarkWorld(100000);
+        if (meshObject->format() != "offpm") return;
+        Scene::MeshObject copy(meshObject->inFileName()); // seeks on a copy, so the one on screen keeps its LOD and checkpoints
+        copy.readGeom();
+        std::vector<std::pair<std::string, double>> times;
+        Scene::benchmarkSeek(&copy, times);
+        printf("Seek benchmark, %i vertices\n", copy.nVertices());
+        for (int i = 0; i < (int)times.size(); i++) printf("  %s %.2f ms\n", times[i].first.c_str(), times[i].second);
+    };
+    auto klambda = [&]() {
+        if (meshFree() == false) return;
+        simplifier.start(meshObject, 0, [&](Scene::MeshObject* mesh) { // no collapses, just the worker's hold on the mesh while the DAG reads it
+            dag.build(mesh);
+            printf("Cluster DAG: %i clusters, %i groups, %i levels\n", dag.nClusters(), dag.nGroups(), dag.nLevels());
+        });
+    };
+    auto mlambda = [&]() {
+        if (meshObject->format() == "off" && meshFree() == true) {
+            simplifier.start(meshObject, meshObject->nVertices(), [](Scene::MeshObject* mesh) {
+                printf("\nMaking Progressive Mesh File: %s\n", mesh->outFileName().c_str());
+                mesh->makeProgressiveMeshFile();
+            });
         }
     };
+    auto elambda = [&]() {
+        meshObject->toggleAutoLOD();
+        printf("Screen-space error LOD %s, tolerance %.1f pixels\n", meshObject->autoLOD() == true ? "on" : "off", meshObject->pixelTolerance());
+    };
+    auto glambda = [&]() {
+        world.setTriangleBudget(world.triangleBudget() > 0 ? 0 : meshObject->nFaces() / 2); // half the full mesh, to see it share out
+        if (world.triangleBudget() > 0) printf("Triangle budget %i, shared by screen-space error\n", world.triangleBudget());
+        else printf("Triangle budget off\n");
+    };
+    std::vector<Scene::MeshInstance*> instances; // copies of the loaded .offpm in a row beside it, all drawing one ProgressiveMesh
+    auto rlambda = [&]() {
+        if (meshObject->format() != "offpm" || meshFree() == false) return;
+        std::shared_ptr<const Scene::ProgressiveMesh> asset = Scene::ProgressiveMesh::load(meshObject->inFileName(), meshObject);
+        if (asset == nullptr) return;
+        Scene::MeshInstance* instance = new Scene::MeshInstance(asset);
+        instance->setTx(-xMid + (instances.size() + 1) * 1.25f * xSpan);
+        instance->setTy(-yMid);
+        instance->setTz(-zMid);
+        instance->setTargetComplexity(asset->complexityAt(0) / (1 << (instances.size() % 8))); // each heads for a LOD of its own
+        world.addObject(instance);
+        instances.push_back(instance);
+        printf("%i instances: %.1f KB shared, %.1f KB each\n", (int)instances.size(), asset->nBytes() / 1024.0, instance->nBytes() / 1024.0);
+    };
+    Scene::InstancedMesh* crowd = nullptr; // rows of copies of the loaded .offpm behind it, drawn a LOD bucket at a time
+    auto wlambda = [&]() {
+        if (meshObject->format() != "offpm") return;
+        if (crowd == nullptr) {
+            if (meshFree() == false) return;
+            std::shared_ptr<const Scene::ProgressiveMesh> asset = Scene::ProgressiveMesh::load(meshObject->inFileName(), meshObject);
+            if (asset == nullptr) return;
+            crowd = new Scene::InstancedMesh(asset);
+            world.addObject(crowd);
+        }
+        int row = crowd->size() / 10;
+        for (int i = 0; i < 10; i++) {
+            glm::vec3 offset((i - 4.5f) * 1.25f * xSpan - xMid, -yMid, -(row + 1) * 1.25f * zSpan - zMid);
+            crowd->add(glm::translate(glm::mat4(), offset), glm::vec4(0.5f + 0.05f * i, 1 - 0.05f * row, 1, 1));
+        }
+        printf("%i instanced copies\n", crowd->size());
+    };
+    auto ulambda = [&]() {
+        if (meshObject->format() != "offpm" || meshFree() == false) return;
+        std::shared_ptr<const Scene::ProgressiveMesh> asset = Scene::ProgressiveMesh::load(meshObject->inFileName(), meshObject);
+        if (asset != nullptr) Scene::benchmarkInstancing(asset, 10000);
+    };
+    std::unique_ptr<Scene::ErrorMeter> meter; // against the full-detail surface in the input file, made on first use
+    auto makeMeter = [&]() {
+        if (meter != nullptr) return;
+        Scene::MeshObject reference(meshObject->inFileName());
+        reference.readGeom();
+        if (reference.format() == "offpm") reference.collapseTo(reference.nVertices());
+        meter.reset(new Scene::ErrorMeter(&reference));
+    };
+    auto dlambda = [&]() {
+        if (meshFree() == false) return;
+        makeMeter();
+        Scene::SurfaceError error = meter->measure(meshObject);
+        if (error.empty() == true) printf("No faces left to measure\n");
+        else printf("%i faces: Hausdorff %g (%g to the original, %g back), RMS %g. %.0f ms\n", error._nFaces, error.hausdorff(), error._maxForward, error._maxBackward,
+            error.rms(), meter->measureTime());
+    };
+    auto flambda = [&]() {
+        if (meshObject->format() != "offpm" || meshFree() == false) return;
+        makeMeter();
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<float> complexities;
+        std::vector<Scene::SurfaceError> errors;
+        meter->measureCurve(meshObject, 16, complexities, errors);
+        printf("complexity, faces, Hausdorff, RMS\n");
+        for (int i = 0; i < (int)errors.size(); i++) {
+            if (errors[i].empty() == true) printf("%.0f, 0, empty, empty\n", complexities[i]);
+            else printf("%.0f, %i, %g, %g\n", complexities[i], errors[i]._nFaces, errors[i].hausdorff(), errors[i].rms());
+        }
+        printf("%i LODs in %.2f s\n", (int)errors.size(), std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+    };
+    auto hlambda = [&]() {
+        if (simplifier.running() == true) simplifier.cancel();
+    };
+    auto plambda = [&]() {
+        if (simplifier.running() == true) printf("Simplifying: %i of %i collapses (%.0f%%)\n", simplifier.nDone(), simplifier.target(), 100 * simplifier.progress());
+        else printf("Not simplifying\n");
+    };
     auto pluslambda = [&]() {
         if (meshObject->format() == "offpm") {
-            if (meshObject->complexity() < meshObject->nVertices()) {
+            if (meshObject->targetComplexity() < meshObject->nVertices()) {
                 //std::string bmpName = fileName + std::to_string(bmpCounter) + ".bmp";
                 //SaveAsBMP(bmpName.c_str());
                 //bmpCounter++;
-                meshObject->collapseTo((1.0f + complexityMultiplier)*meshObject->complexity());
+                meshObject->setTargetComplexity((1.0f + complexityMultiplier)*meshObject->targetComplexity()); // reached over the next frames
             }
         }
     };
     auto minuslambda = [&]() {
-        if (meshObject->format() == "offpm") meshObject->collapseTo((1.0 - complexityMultiplier)*meshObject->complexity());
+        if (meshObject->format() == "offpm") meshObject->setTargetComplexity((1.0 - complexityMultiplier)*meshObject->targetComplexity());
     };
     auto rbracketlambda = [&]() {
         if (meshObject->format() == "offpm") {
@@ -268,6 +417,9 @@ int main(int argc, char* argv[])
     auto ylambda = [&]() {
         meshObject->toggleCustomColors();
     };
+    auto vlambda = [&]() {
+        if (meshObject->format() == "offpm") meshObject->toggleViewDependent();
+    };
     keyboard.register_hotkey('\'', quotelambda);
     keyboard.register_hotkey(';', colonlambda);
     keyboard.register_hotkey('/', slashlambda);
@@ -283,8 +435,23 @@ int main(int argc, char* argv[])
     keyboard.register_hotkey('z', zlambda);
     keyboard.register_hotkey('t', tlambda);
     keyboard.register_hotkey('y', ylambda);
+    keyboard.register_hotkey('v', vlambda);
     keyboard.register_hotkey('n', nlambda);
     keyboard.register_hotkey('m', mlambda);
+    keyboard.register_hotkey('o', olambda);
+    keyboard.register_hotkey('l', llambda);
+    keyboard.register_hotkey('k', klambda);
+    keyboard.register_hotkey('c', clambda);
+    keyboard.register_hotkey('b', blambda);
+    keyboard.register_hotkey('g', glambda);
+    keyboard.register_hotkey('r', rlambda);
+    keyboard.register_hotkey('h', hlambda);
+    keyboard.register_hotkey('e', elambda);
+    keyboard.register_hotkey('p', plambda);
+    keyboard.register_hotkey('w', wlambda);
+    keyboard.register_hotkey('u', ulambda);
+    keyboard.register_hotkey('d', dlambda);
+    keyboard.register_hotkey('f', flambda);
 
     MANAGER.drawElements();
 
@@ -5,59 +5,501 @@ using namespace Scene;
 using namespace std;
 using namespace glm;
 /** Global variables **/
-int Object::NEXTID = 0;
+atomic<int> Object::NEXTID(0);
 
 /* Method Definitions */
-void World::addObject(Object * obj)
+ObjectHandle World::addObject(Object * obj)
 {
+    unsigned slot;
+    if (_freeSlots.empty() == false)
+    {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+    else
+    {
+        slot = _slotDense.size();
+        _slotDense.push_back(~0u);
+        _slotGeneration.push_back(0);
+        _slotTouched.push_back(false);
+    }
+    _slotDense[slot] = _objects.size();
     _objects.push_back(obj);
+    auto shader = _shaderMap.find(obj->getID());
+    if (shader != _shaderMap.end())
+    {
+        _shaders.push_back(shader->second);
+        _shaderMap.erase(shader);
+    }
+    else _shaders.push_back(nullptr);
+    _visible.push_back(obj->getVisible());
+    _bounded.push_back(false);
+    _boundsLo.push_back(vec3());
+    _boundsHi.push_back(vec3());
+    _boundsCenter.push_back(vec3());
+    _boundsRadius.push_back(0);
+    _positions.push_back(vec3(obj->getTx(), obj->getTy(), obj->getTz()));
+    _denseSlot.push_back(slot);
+    _meshes.push_back(dynamic_cast<MeshObject *>(obj));
+
     obj->setWorld(this);
+    obj->_handle = ObjectHandle(slot, _slotGeneration[slot]);
+    obj->_transformDirty = true; // it may have moved while outside any world
+    obj->_boundsDirty = true;
+    _touch(obj->_handle);
+    return obj->_handle;
 }
 
-void World::addObject(Camera * cam)
+ObjectHandle World::addObject(Camera * cam)
 {
     if (_cam == nullptr)
     {
-        _objects.push_back(cam);
-        cam->setWorld(this);
         _cam = cam;
+        return addObject((Object *)cam);
     }
     else
     {
         std::cout << "Cam already set!" << std::endl;
+        return ObjectHandle();
+    }
+}
+
+int World::_dense(ObjectHandle handle)
+{
+    if (handle._index >= _slotDense.size() || _slotGeneration[handle._index] != handle._generation) return -1;
+    return _slotDense[handle._index];
+}
+
+Object * World::get(ObjectHandle handle)
+{
+    int i = _dense(handle);
+    return i != -1 ? _objects[i] : nullptr;
+}
+
+void World::_touch(ObjectHandle handle)
+{
+    if (_dense(handle) == -1 || _slotTouched[handle._index] == true) return;
+    _slotTouched[handle._index] = true;
+    _touched.push_back(handle._index);
+}
+
+void World::updateTransforms()
+{
+    _moved.clear();
+    _transforms.clear();
+    for (auto &slot : _touched)
+    {
+        _slotTouched[slot] = false;
+        if (_slotDense[slot] == ~0u) continue; // removed since it was touched
+        Object * object = _objects[_slotDense[slot]];
+        if (object->_transformDirty == false) continue;
+        _moved.push_back(slot);
+        _transforms.push_back(vec3(object->_tx, object->_ty, object->_tz), vec3(object->_phi, object->_the, object->_psi));
+    }
+    composeTransforms(_transforms, _matrices);
+    for (int i = 0; i < (int)_moved.size(); i++)
+    {
+        Object * object = _objects[_slotDense[_moved[i]]];
+        object->_modelMatrix = _matrices[i];
+        object->_transformDirty = false;
     }
+    for (auto &slot : _touched)
+    {
+        unsigned i = _slotDense[slot];
+        if (i == ~0u) continue;
+        Object * object = _objects[i];
+        _visible[i] = object->_visible;
+        _positions[i] = vec3(object->_tx, object->_ty, object->_tz);
+        _bounded[i] = object->worldBounds(_boundsLo[i], _boundsHi[i]) && object->worldBounds(_boundsCenter[i], _boundsRadius[i]);
+    }
+    _touched.clear();
+    _nTransformUpdates = _moved.size();
 }
 
 void World::draw()
 {
-    for (auto &object : _objects)
+    updateTransforms();
+    mat4 view, projection;
+    glGetFloatv(GL_MODELVIEW_MATRIX, &view[0][0]);
+    glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+    Frustum frustum(projection * view);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float kappa = pixelsPerUnit(projection, viewport[3]);
+    _nDrawn = 0;
+    _nCulled = 0;
+    _lodEntries.clear();
+    for (int i = 0; i < (int)_objects.size(); i++) // only the arrays until an object is known to be drawn
+    {
+        if (_visible[i] == false) continue;
+        vec3 center = _positions[i];
+        if (_bounded[i] == true)
+        {
+            if (frustum.outside(_boundsCenter[i], _boundsRadius[i]) == true || frustum.outside(_boundsLo[i], _boundsHi[i]) == true)
+            {
+                _nCulled++;
+                continue;
+            }
+            center = _boundsCenter[i];
+        }
+        _nDrawn++;
+        float depth = -(view * vec4(center, 1))[2];
+        _queue.add(_objects[i], _shaders[i], depth);
+        MeshObject * mesh = _meshes[i];
+        if (_triangleBudget <= 0 || mesh == nullptr || _bounded[i] == false) continue;
+        if (mesh->errorCurve().size() < 2 || mesh->viewDependent() == true || mesh->autoLOD() == true || mesh->simplifying() == true) continue;
+        LODEntry entry;
+        entry._mesh = mesh;
+        entry._scale = kappa / fmax(depth - _boundsRadius[i], 0.001f); // the camera inside the bounds makes any error large
+        _lodEntries.push_back(entry);
+    }
+    if (_triangleBudget > 0) _allocateTriangles();
+    _queue.submit();
+    _lines.draw();
+}
+
+namespace {
+const float LOD_BUDGET_HYSTERESIS = 0.1f; // a trade between meshes has to win by this much, so small camera moves don't flip it back and forth
+}
+void World::_allocateTriangles()
+{
+    priority_queue<LODMove> refine, coarsen; // coarsen holds negated rates, so both pop their best move first
+    auto error = [&](const LODEntry& entry, const int& index) { // read off the convex hull of the curve, so steps across a flat stretch still see the rise after it
+        MeshObject * mesh = entry._mesh;
+        const vector<int>& hull = mesh->errorHull();
+        auto it = lower_bound(hull.begin(), hull.end(), index);
+        if (*it == index) return entry._scale * mesh->errorCurve()[index];
+        int a = *(it - 1), b = *it;
+        float t = (float)(mesh->nFacesAt(a) - mesh->nFacesAt(index)) / (mesh->nFacesAt(a) - mesh->nFacesAt(b));
+        return entry._scale * ((1 - t) * mesh->errorCurve()[a] + t * mesh->errorCurve()[b]);
+    };
+    auto finer = [&](const LODEntry& entry) { return (int)fmax(0, entry._index - LOD_BUDGET_STEP); };
+    auto coarser = [&](const LODEntry& entry) { return (int)fmin(entry._mesh->errorCurve().size() - 1, entry._index + LOD_BUDGET_STEP); };
+    auto requeue = [&](const int& i) {
+        LODEntry& entry = _lodEntries[i];
+        entry._version++;
+        int to = finer(entry);
+        if (to != entry._index) refine.push(LODMove((error(entry, entry._index) - error(entry, to)) / fmax(1, entry._mesh->nFacesAt(to) - entry._mesh->nFacesAt(entry._index)), i, entry._version));
+        to = coarser(entry);
+        if (to != entry._index) coarsen.push(LODMove(-(error(entry, to) - error(entry, entry._index)) / fmax(1, entry._mesh->nFacesAt(entry._index) - entry._mesh->nFacesAt(to)), i, entry._version));
+    };
+    auto move = [&](const int& i, const int& to) {
+        LODEntry& entry = _lodEntries[i];
+        _nBudgetTriangles += entry._mesh->nFacesAt(to) - entry._mesh->nFacesAt(entry._index);
+        entry._index = to;
+        requeue(i);
+    };
+    auto top = [&](priority_queue<LODMove>& moves) { // drop moves queued before their entry last changed
+        while (moves.empty() == false && moves.top()._version != _lodEntries[moves.top()._entry]._version) moves.pop();
+        return moves.empty() == false;
+    };
+
+    _nBudgetTriangles = 0;
+    for (int i = 0; i < (int)_lodEntries.size(); i++) // start from last frame's answer, so only what the camera changed needs moving
+    {
+        LODEntry& entry = _lodEntries[i];
+        entry._index = entry._start = entry._mesh->targetCollapseIndex();
+        entry._version = 0;
+        _nBudgetTriangles += entry._mesh->nFacesAt(entry._index);
+        requeue(i);
+    }
+    while (_nBudgetTriangles > _triangleBudget && top(coarsen) == true) // over budget: give up the detail that costs least error per triangle
+    {
+        int i = coarsen.top()._entry;
+        move(i, coarser(_lodEntries[i]));
+    }
+    while (top(refine) == true) // spend what is left, or trade a coarser step elsewhere when that lowers the total error
+    {
+        int i = refine.top()._entry;
+        refine.pop();
+        LODEntry& entry = _lodEntries[i];
+        int to = finer(entry);
+        int added = entry._mesh->nFacesAt(to) - entry._mesh->nFacesAt(entry._index);
+        if (_nBudgetTriangles + added <= _triangleBudget)
+        {
+            move(i, to);
+            continue;
+        }
+        if (top(coarsen) == false || coarsen.top()._entry == i) continue;
+        int j = coarsen.top()._entry;
+        LODEntry& other = _lodEntries[j];
+        int otherTo = coarser(other);
+        int freed = other._mesh->nFacesAt(other._index) - other._mesh->nFacesAt(otherTo);
+        float gained = error(entry, entry._index) - error(entry, to);
+        float lost = error(other, otherTo) - error(other, other._index);
+        if (_nBudgetTriangles + added - freed > _triangleBudget || gained <= (1 + LOD_BUDGET_HYSTERESIS) * lost) continue;
+        move(j, otherTo);
+        move(i, to);
+    }
+    for (auto &entry : _lodEntries)
+    {
+        if (entry._index != entry._start) entry._mesh->setTargetCollapseIndex(entry._index);
+    }
+}
+
+mat4 Scene::composeTransform(const vec3& translation, const vec3& angles)
+{
+    float cPhi = cos(radians(angles[0])), sPhi = sin(radians(angles[0]));
+    float cThe = cos(radians(angles[1])), sThe = sin(radians(angles[1]));
+    float cPsi = cos(radians(angles[2])), sPsi = sin(radians(angles[2]));
+    mat4 model; // columns of Rz(psi) * Ry(the) * Rz(phi), then the translation
+    model[0] = vec4(cPsi * cThe * cPhi - sPsi * sPhi, sPsi * cThe * cPhi + cPsi * sPhi, -sThe * cPhi, 0);
+    model[1] = vec4(-cPsi * cThe * sPhi - sPsi * cPhi, -sPsi * cThe * sPhi + cPsi * cPhi, sThe * sPhi, 0);
+    model[2] = vec4(cPsi * sThe, sPsi * sThe, cThe, 0);
+    model[3] = vec4(translation, 1);
+    return model;
+}
+
+void TransformArrays::clear()
+{
+    _tx.clear();
+    _ty.clear();
+    _tz.clear();
+    _phi.clear();
+    _the.clear();
+    _psi.clear();
+}
+
+void TransformArrays::push_back(const vec3& translation, const vec3& angles)
+{
+    _tx.push_back(translation[0]);
+    _ty.push_back(translation[1]);
+    _tz.push_back(translation[2]);
+    _phi.push_back(angles[0]);
+    _the.push_back(angles[1]);
+    _psi.push_back(angles[2]);
+}
+
+namespace {
+void sinCosDegrees(const __m128& degrees, __m128& s, __m128& c) // four at once, to about float precision for angles under 2^22 quarter turns
+{
+    // Reducing by whole quarter turns is exact in degrees. What is left is within 45 degrees, where short polynomials do
+    const __m128 round = _mm_set1_ps(12582912.0f); // 1.5 * 2^23. adding and taking it away rounds to an integer
+    __m128 k = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(degrees, _mm_set1_ps(1 / 90.0f)), round), round);
+    __m128 r = _mm_mul_ps(_mm_sub_ps(degrees, _mm_mul_ps(k, _mm_set1_ps(90))), _mm_set1_ps(3.14159265f / 180));
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 sr = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), r2), _mm_set1_ps(8.3321608736e-3f)); // the single precision sinf and cosf ones
+    sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(-1.6666654611e-1f));
+    sr = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sr, r2), r), r);
+    __m128 cr = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), r2), _mm_set1_ps(-1.388731625493765e-3f));
+    cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(4.166664568298827e-2f));
+    cr = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(cr, r2), r2), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_set1_ps(1));
+    __m128 quarter = _mm_sub_ps(k, _mm_mul_ps(_mm_set1_ps(4), _mm_sub_ps(_mm_add_ps(_mm_mul_ps(k, _mm_set1_ps(0.25f)), round), round))); // k mod 4, in -2..2
+    quarter = _mm_add_ps(quarter, _mm_and_ps(_mm_cmplt_ps(quarter, _mm_setzero_ps()), _mm_set1_ps(4))); // 0..3
+    __m128 odd = _mm_or_ps(_mm_cmpeq_ps(quarter, _mm_set1_ps(1)), _mm_cmpeq_ps(quarter, _mm_set1_ps(3))); // sine and cosine trade places
+    __m128 sinNegative = _mm_cmpge_ps(quarter, _mm_set1_ps(2));
+    __m128 cosNegative = _mm_or_ps(_mm_cmpeq_ps(quarter, _mm_set1_ps(1)), _mm_cmpeq_ps(quarter, _mm_set1_ps(2)));
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    s = _mm_or_ps(_mm_and_ps(odd, cr), _mm_andnot_ps(odd, sr));
+    c = _mm_or_ps(_mm_and_ps(odd, sr), _mm_andnot_ps(odd, cr));
+    s = _mm_xor_ps(s, _mm_and_ps(sinNegative, sign));
+    c = _mm_xor_ps(c, _mm_and_ps(cosNegative, sign));
+}
+}
+
+void Scene::composeTransforms(const TransformArrays& transforms, vector<mat4>& matrices)
+{
+    int n = transforms.size();
+    matrices.resize(n);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 cPhi, sPhi, cThe, sThe, cPsi, sPsi;
+        sinCosDegrees(_mm_loadu_ps(&transforms._phi[i]), sPhi, cPhi);
+        sinCosDegrees(_mm_loadu_ps(&transforms._the[i]), sThe, cThe);
+        sinCosDegrees(_mm_loadu_ps(&transforms._psi[i]), sPsi, cPsi);
+        __m128 cPsiThe = _mm_mul_ps(cPsi, cThe), sPsiThe = _mm_mul_ps(sPsi, cThe);
+        __m128 columns[4][4]; // as composeTransform, each entry for the four objects
+        columns[0][0] = _mm_sub_ps(_mm_mul_ps(cPsiThe, cPhi), _mm_mul_ps(sPsi, sPhi));
+        columns[0][1] = _mm_add_ps(_mm_mul_ps(sPsiThe, cPhi), _mm_mul_ps(cPsi, sPhi));
+        columns[0][2] = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(sThe, cPhi));
+        columns[1][0] = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_mul_ps(cPsiThe, sPhi), _mm_mul_ps(sPsi, cPhi)));
+        columns[1][1] = _mm_sub_ps(_mm_mul_ps(cPsi, cPhi), _mm_mul_ps(sPsiThe, sPhi));
+        columns[1][2] = _mm_mul_ps(sThe, sPhi);
+        columns[2][0] = _mm_mul_ps(cPsi, sThe);
+        columns[2][1] = _mm_mul_ps(sPsi, sThe);
+        columns[2][2] = cThe;
+        columns[3][0] = _mm_loadu_ps(&transforms._tx[i]);
+        columns[3][1] = _mm_loadu_ps(&transforms._ty[i]);
+        columns[3][2] = _mm_loadu_ps(&transforms._tz[i]);
+        for (int k = 0; k < 3; k++) columns[k][3] = _mm_setzero_ps();
+        columns[3][3] = _mm_set1_ps(1);
+        for (int k = 0; k < 4; k++)
+        {
+            _MM_TRANSPOSE4_PS(columns[k][0], columns[k][1], columns[k][2], columns[k][3]); // now column k of each object in turn
+            for (int j = 0; j < 4; j++) _mm_storeu_ps(&matrices[i + j][k][0], columns[k][j]);
+        }
+    }
+    for (; i < n; i++) matrices[i] = composeTransform(vec3(transforms._tx[i], transforms._ty[i], transforms._tz[i]), vec3(transforms._phi[i], transforms._the[i], transforms._psi[i]));
+}
+
+void RenderQueue::add(Object * object, Shader * shader, const float& depth)
+{
+    DrawItem item;
+    unsigned long long program = shader != nullptr ? shader->getProgram() : 0;
+    unsigned long long vertexArray = object->vertexArray();
+    union { float f; unsigned int u; } depthBits;
+    depthBits.f = fmax(depth, 0); // non-negative floats order like their bits
+    item._key = ((program & 0xFFFF) << 48) | ((vertexArray & 0xFFFF) << 32) | depthBits.u;
+    item._object = object;
+    item._shader = shader;
+    _items.push_back(item);
+}
+
+namespace {
+GLuint boundVertexArray = 0; // what bindVertexArray last bound
+}
+void Scene::bindVertexArray(const GLuint& vertexArray)
+{
+    if (vertexArray == boundVertexArray) return;
+    glBindVertexArray(vertexArray);
+    boundVertexArray = vertexArray;
+}
+
+void Scene::bindElementBuffer(const GLuint& buffer)
+{
+    bindVertexArray(0); // the element buffer binding belongs to the vertex array, which should keep its own
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
+
+float Scene::pixelsPerUnit(const mat4& projection, const float& viewportHeight)
+{
+    return projection[1][1] * viewportHeight / 2.0f;
+}
+
+int Scene::collapseIndexForError(const vector<float>& errorCurve, const float& maxError)
+{
+    if (errorCurve.size() < 2) return 0;
+    return upper_bound(errorCurve.begin(), errorCurve.end(), maxError) - errorCurve.begin() - 1;
+}
+
+void RenderQueue::submit()
+{
+    sort(_items.begin(), _items.end());
+    _nDrawCalls = 0;
+    _nStateChanges = 0;
+    Shader * current = nullptr; // frames start with the fixed pipeline bound
+    GLuint currentVertexArray = 0;
+    for (auto &item : _items)
     {
-        auto shader = _shaderMap.find(object->getID());
-        if (shader != _shaderMap.end())
+        if (item._shader != current && (item._shader == nullptr || current == nullptr || item._shader->getProgram() != current->getProgram()))
         {
-            object->draw(_shaderMap[object->getID()]);
+            if (item._shader != nullptr) item._shader->link();
+            else current->unlink();
+            _nStateChanges++;
         }
-        else
+        current = item._shader;
+        if (current != nullptr) current->setModelMatrix(item._object->modelMatrix());
+        GLuint vertexArray = item._object->vertexArray();
+        if (vertexArray != currentVertexArray) // objects without one get 0 bound, so their client arrays can't land in another's
         {
-            object->draw();
+            bindVertexArray(vertexArray);
+            currentVertexArray = vertexArray;
+            _nStateChanges++;
         }
+        item._object->draw();
+        _nDrawCalls++;
     }
+    bindVertexArray(0);
+    if (current != nullptr) current->unlink();
+    _items.clear();
 }
 
 void World::removeObject(Object * obj)
 {
-    auto sameID = [&](Object * object) { return object->getID() == obj->getID();  };
-    auto to_remove = std::remove_if(std::begin(_objects), std::end(_objects), sameID);
-    _objects.erase(to_remove);
+    if (get(obj->_handle) == obj) removeObject(obj->_handle);
+    else _shaderMap.erase(obj->getID());
+}
+
+void World::removeObject(ObjectHandle handle)
+{
+    int i = _dense(handle);
+    if (i == -1) return;
+    Object * obj = _objects[i];
+    int last = _objects.size() - 1;
+    _objects[i] = _objects[last];
+    _shaders[i] = _shaders[last];
+    _visible[i] = _visible[last];
+    _bounded[i] = _bounded[last];
+    _boundsLo[i] = _boundsLo[last];
+    _boundsHi[i] = _boundsHi[last];
+    _boundsCenter[i] = _boundsCenter[last];
+    _boundsRadius[i] = _boundsRadius[last];
+    _positions[i] = _positions[last];
+    _denseSlot[i] = _denseSlot[last];
+    _meshes[i] = _meshes[last];
+    _slotDense[_denseSlot[i]] = i;
+    _objects.pop_back();
+    _shaders.pop_back();
+    _visible.pop_back();
+    _bounded.pop_back();
+    _boundsLo.pop_back();
+    _boundsHi.pop_back();
+    _boundsCenter.pop_back();
+    _boundsRadius.pop_back();
+    _positions.pop_back();
+    _denseSlot.pop_back();
+    _meshes.pop_back();
+
+    _slotDense[handle._index] = ~0u;
+    _slotGeneration[handle._index]++;
+    _freeSlots.push_back(handle._index);
+    if (_cam == obj) _cam = nullptr;
+    obj->setWorld(nullptr);
+    obj->_handle = ObjectHandle();
 }
 
 void World::assignShader(Object * obj, Shader * shader)
 {
-    _shaderMap[obj->getID()] = shader;
+    int i = _dense(obj->_handle);
+    if (i != -1 && _objects[i] == obj) _shaders[i] = shader;
+    else _shaderMap[obj->getID()] = shader;
 }
 Shader * World::findShader(Object * obj)
 {
-    return _shaderMap[obj->getID()];
+    int i = _dense(obj->_handle);
+    if (i != -1 && _objects[i] == obj) return _shaders[i];
+    auto shader = _shaderMap.find(obj->getID());
+    return shader != _shaderMap.end() ? shader->second : nullptr;
+}
+
+void Scene::benchmarkWorld(int nObjects)
+{
+    typedef chrono::high_resolution_clock Clock;
+    auto ms = [](Clock::time_point start) { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+    World world;
+    vector<Arrow *> arrows(nObjects);
+    for (int i = 0; i < nObjects; i++)
+    {
+        float x = (rand() / (float)RAND_MAX - 0.5f) * 200, y = (rand() / (float)RAND_MAX - 0.5f) * 200, z = (rand() / (float)RAND_MAX - 0.5f) * 200;
+        arrows[i] = new Arrow(vec3(x, y, z), vec3(x, y, z + 1));
+    }
+
+    auto start = Clock::now();
+    for (auto &arrow : arrows) world.addObject(arrow);
+    double addTime = ms(start);
+
+    start = Clock::now();
+    world.draw();
+    double firstDrawTime = ms(start);
+    start = Clock::now();
+    world.draw();
+    double drawTime = ms(start);
+    for (int i = 0; i < nObjects; i += 10) arrows[i]->setTz(1);
+    start = Clock::now();
+    world.draw();
+    double movedDrawTime = ms(start);
+    int nDrawn = world.nDrawn(), nCulled = world.nCulled();
+
+    shuffle(arrows.begin(), arrows.end(), mt19937(5)); // removals in an order unrelated to the adds, the same every run
+    start = Clock::now();
+    for (auto &arrow : arrows) world.removeObject(arrow);
+    double removeTime = ms(start);
+    for (auto &arrow : arrows) delete arrow;
+
+    printf("World benchmark, %d objects (%d drawn, %d culled)\n", nObjects, nDrawn, nCulled);
+    printf("  add %.2f ms, first draw %.2f ms, draw %.2f ms, draw after moving a tenth %.2f ms, remove %.2f ms\n",
+        addTime, firstDrawTime, drawTime, movedDrawTime, removeTime);
 }
 
 
@@ -66,10 +508,7 @@ void Object::draw()
     if (!_visible) return;
 
     glPushMatrix();
-    glTranslated(_tx, _ty, _tz);
-    glRotated(_psi, 0, 0, 1);
-    glRotated(_the, 0, 1, 0);
-    glRotated(_phi, 0, 0, 1);
+    glMultMatrixf(&modelMatrix()[0][0]);
 
     doDraw();
 
@@ -81,17 +520,156 @@ void Object::draw(Shader * shader)
     if (!_visible) return;
 
     glPushMatrix();
-    glTranslated(_tx, _ty, _tz);
-    glRotated(_psi, 0, 0, 1);
-    glRotated(_the, 0, 1, 0);
-    glRotated(_phi, 0, 0, 1);
+    glMultMatrixf(&modelMatrix()[0][0]);
 
     shader->link();
+    shader->setModelMatrix(modelMatrix());
     doDraw();
     shader->unlink();
     glPopMatrix();
 }
 
+const mat4& Object::modelMatrix()
+{
+    if (_transformDirty == true)
+    {
+        _modelMatrix = composeTransform(vec3(_tx, _ty, _tz), vec3(_phi, _the, _psi));
+        _transformDirty = false;
+    }
+    return _modelMatrix;
+}
+
+bool Object::worldBounds(vec3& lo, vec3& hi)
+{
+    if (_boundsDirty == true) _updateBounds();
+    lo = _boundsLo;
+    hi = _boundsHi;
+    return _bounded;
+}
+
+bool Object::worldBounds(vec3& center, float& radius)
+{
+    if (_boundsDirty == true) _updateBounds();
+    center = _boundsCenter;
+    radius = _boundsRadius;
+    return _bounded;
+}
+
+void Object::_updateBounds()
+{
+    vec3 lo, hi;
+    _bounded = localBounds(lo, hi);
+    _boundsDirty = false;
+    if (_bounded == false) return;
+    mat4 model = modelMatrix();
+    _boundsLo = vec3(INFINITY, INFINITY, INFINITY);
+    _boundsHi = -_boundsLo;
+    for (int k = 0; k < 8; k++)
+    {
+        vec3 corner((k & 1) ? hi[0] : lo[0], (k & 2) ? hi[1] : lo[1], (k & 4) ? hi[2] : lo[2]);
+        vec3 p(model * vec4(corner, 1));
+        _boundsLo = min(_boundsLo, p);
+        _boundsHi = max(_boundsHi, p);
+    }
+    _boundsCenter = vec3(model * vec4(0.5f * (lo + hi), 1)); // the model matrix is rigid, so the sphere keeps its radius
+    _boundsRadius = 0.5f * length(hi - lo);
+}
+
+
+Frustum::Frustum(const mat4& viewProjection)
+{
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++) rows[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    for (int i = 0; i < 3; i++) // Gribb and Hartmann: left, right, bottom, top, near, far
+    {
+        _planes[2 * i + 0] = rows[3] + rows[i];
+        _planes[2 * i + 1] = rows[3] - rows[i];
+    }
+    for (int i = 0; i < 6; i++) _planes[i] /= length(vec3(_planes[i]));
+}
+
+bool Frustum::outside(const vec3& center, const float& radius) const
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (dot(vec3(_planes[i]), center) + _planes[i][3] < -radius) return true;
+    }
+    return false;
+}
+
+bool Frustum::outside(const vec3& lo, const vec3& hi) const
+{
+    for (int i = 0; i < 6; i++) // the corner furthest along the plane normal decides
+    {
+        vec3 p(_planes[i][0] > 0 ? hi[0] : lo[0], _planes[i][1] > 0 ? hi[1] : lo[1], _planes[i][2] > 0 ? hi[2] : lo[2]);
+        if (dot(vec3(_planes[i]), p) + _planes[i][3] < 0) return true;
+    }
+    return false;
+}
+
+void Object::_drawLine(const vec3& a, const vec3& b, const vec4& color)
+{
+    if (_world != nullptr)
+    {
+        _world->lines().add(a, b, color, modelMatrix());
+        return;
+    }
+    glPushAttrib(GL_CURRENT_BIT);
+    glColor4f(color[0], color[1], color[2], color[3]);
+    GlutDraw::drawLine(a[0], a[1], a[2], b[0], b[1], b[2]);
+    glPopAttrib();
+}
+
+
+void LineBatch::add(const vec3& a, const vec3& b, const vec4& color)
+{
+    LineVertex v;
+    v._color = packColor(color);
+    v._position = a;
+    _vertices.push_back(v);
+    v._position = b;
+    _vertices.push_back(v);
+}
+
+void LineBatch::add(const vec3& a, const vec3& b, const vec4& color, const mat4& transform)
+{
+    add(vec3(transform * vec4(a, 1)), vec3(transform * vec4(b, 1)), color);
+}
+
+void LineBatch::draw()
+{
+    if (_vertices.size() == 0) return;
+    if (_vertexArrayID == 0)
+    {
+        glGenVertexArrays(1, &_vertexArrayID);
+        bindVertexArray(_vertexArrayID);
+        glGenBuffers(1, &_bufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(LineVertex), (void*)offsetof(LineVertex, _position));
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(LineVertex), (void*)offsetof(LineVertex, _color));
+        bindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+    if (_vertices.size() > _capacity) _capacity = 2 * _vertices.size();
+    glBufferData(GL_ARRAY_BUFFER, sizeof(LineVertex)*_capacity, NULL, GL_STREAM_DRAW); // orphan last frame's copy instead of waiting for it
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(LineVertex)*_vertices.size(), _vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bindVertexArray(_vertexArrayID);
+    glDrawArrays(GL_LINES, 0, _vertices.size());
+    bindVertexArray(0);
+    _vertices.clear();
+}
+
+LineBatch::~LineBatch()
+{
+    if (_vertexArrayID == 0) return;
+    bindVertexArray(0);
+    glDeleteVertexArrays(1, &_vertexArrayID);
+    glDeleteBuffers(1, &_bufferID);
+}
+
 
 void Camera::doDraw()
 {
@@ -99,22 +677,21 @@ void Camera::doDraw()
 
 void Grid::doDraw()
 {
+    vec4 color(1, 1, 1, 1);
     for (int r = -(_rows / 2); r <= (_rows / 2); r++)
     {
-        GlutDraw::drawLine(-(_cols / 2.0f)*_gap, 0, r*_gap,
-            (_cols / 2.0f)*_gap, 0, r*_gap);
+        _drawLine(vec3(-(_cols / 2.0f)*_gap, 0, r*_gap),
+            vec3((_cols / 2.0f)*_gap, 0, r*_gap), color);
     }
     for (int c = -(_cols / 2); c <= (_cols / 2); c++)
     {
-        GlutDraw::drawLine(c*_gap, 0, -(_rows / 2.0f)*_gap,
-            c*_gap, 0, (_rows / 2.0f)*_gap);
+        _drawLine(vec3(c*_gap, 0, -(_rows / 2.0f)*_gap),
+            vec3(c*_gap, 0, (_rows / 2.0f)*_gap), color);
     }
 }
 
 void Arrow::doDraw() {
-    glPushAttrib(GL_CURRENT_BIT);
-    glColor3f(_color[0], _color[1], _color[2]);
-    GlutDraw::drawLine(_tail[0], _tail[1], _tail[2], _head[0], _head[1], _head[2]);
+    _drawLine(_tail, _head, vec4(_color[0], _color[1], _color[2], 1));
 
     //float d = distance(_head, _tail);
     //vec3 n = normalize(_head - _tail);
@@ -122,7 +699,6 @@ void Arrow::doDraw() {
     //glBegin(GL_TRIANGLE_FAN);
     //glVertex3f(_head[0], _head[1], _head[2]);
     //glEnd();
-    glPopAttrib();
 }
 
 void Sphere::doDraw()
@@ -264,6 +840,7 @@ void Shader::_initShaders()
     }
 
     char *vs, *fs;
+    bool compiled = true;
 
     if (_vertfile == "" && _fragfile == ""){ return; }
     _program = glCreateProgram();
@@ -271,33 +848,50 @@ void Shader::_initShaders()
     if (_vertfile != "")
     {
         _vertex = glCreateShader(GL_VERTEX_SHADER);
-        vs = textFileRead(_vertfile.c_str());
-        const char * vv = vs;
+        std::string source = _vertSource;
+        if (source.empty() == true)
+        {
+            vs = textFileRead(_vertfile.c_str());
+            source = vs;
+            free(vs);
+        }
+        const char * vv = source.c_str();
         glShaderSource(_vertex, 1, &vv, NULL);
-        free(vs);
         glCompileShader(_vertex);
         if (_checkShaderError(_vertex))
         {
             std::cout << _vertfile << " compiled successfully." << std::endl;
             glAttachShader(_program, _vertex);
         }
+        else compiled = false;
     }
     if (_fragfile != "")
     {
         _frag = glCreateShader(GL_FRAGMENT_SHADER);
-        fs = textFileRead(_fragfile.c_str());
-        const char * ff = fs;
+        std::string source = _fragSource;
+        if (source.empty() == true)
+        {
+            fs = textFileRead(_fragfile.c_str());
+            source = fs;
+            free(fs);
+        }
+        const char * ff = source.c_str();
         glShaderSource(_frag, 1, &ff, NULL);
-        free(fs);
         glCompileShader(_frag);
         if (_checkShaderError(_frag))
         {
             std::cout << _fragfile << " compiled successfully." << std::endl;
             glAttachShader(_program, _frag);
         }
+        else compiled = false;
     }
 
     glLinkProgram(_program);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(_program, GL_LINK_STATUS, &linked);
+    _linked = compiled == true && linked == GL_TRUE; // a missing stage can still link, with the fixed pipeline in its place
+    if (linked != GL_TRUE) std::cout << _vertfile << " and " << _fragfile << " failed to link." << std::endl;
+    _modelMatrixLocation = glGetUniformLocation(_program, "modelMatrix");
 
     glDetachShader(_program, _vertex);
     glDetachShader(_program, _frag);
@@ -308,6 +902,17 @@ void Shader::_initShaders()
     return;
 }
 
+Shader * Shader::fromSource(const std::string& name, const std::string& vertSource, const std::string& fragSource)
+{
+    Shader * shader = new Shader();
+    shader->_vertfile = name + " vertex shader"; // only for the messages
+    shader->_fragfile = name + " fragment shader";
+    shader->_vertSource = vertSource;
+    shader->_fragSource = fragSource;
+    shader->_initShaders();
+    return shader;
+}
+
 bool Shader::_checkShaderError(GLuint shader)
 {
     GLint result = 0;
@@ -382,7 +987,7 @@ void MeshObject::makeProgressiveMeshFile() {
     oFile.open(_oFileName);
     oFile << "OFFPM\n";
     oFile << nVertices() << ' ' << _faces.size() << '\n';
-    oFile << _adjacency.size() << ' ' << nVisibleFaces() << ' ' << _nCollapses << '\n';
+    oFile << _adjacency.size() << ' ' << nVisibleFaces() << ' ' << _nCollapses << ' ' << 1 << '\n'; // 1: every collapse record ends with an error line
     oFile << _xMin << ' ' << _xMax << ' ' << _yMin << ' ' << _yMax << ' ' << _zMin << ' ' << _zMax << '\n';
     // write vertices to string
     for (map<int, set<int>>::iterator adj = _adjacency.begin(); adj != _adjacency.end(); adj++) {
@@ -399,35 +1004,174 @@ void MeshObject::makeProgressiveMeshFile() {
         vector<int> v = _faces[f];
         oFile << f << ' ' << v[0] << ' ' << v[1] << ' ' << v[2] << '\n';
     }
-    // write collapses to string
-    for (int i = 0; i < _v0.size(); i++) {
-        oFile << _v0[i] << ' ';
-        oFile << _xyz0[i][0] << ' ' << _xyz0[i][1] << ' ' << _xyz0[i][2] << ' ';
-        oFile << _n0[i][0] << ' ' << _n0[i][1] << ' ' << _n0[i][2] << ' ';
-        oFile << _xyz[i][0] << ' ' << _xyz[i][1] << ' ' << _xyz[i][2] << ' ';
-        oFile << _n[i][0] << ' ' << _n[i][1] << ' ' << _n[i][2];
-        for (int j = 0; j < _fVec[i].size(); j++) {
-            oFile << ' ' << _fVec[i][j];
-        }
-        oFile << '\n'; //////////////////////////////////////////////////////////
-        oFile << _v1[i] << ' ';
-        oFile << _xyz1[i][0] << ' ' << _xyz1[i][1] << ' ' << _xyz1[i][2] << ' ';
-        oFile << _n1[i][0] << ' ' << _n1[i][1] << ' ' << _n1[i][2];
-        for (int j = 0; j < _fVec1[i].size(); j++) {
-            oFile << ' ' << _fVec1[i][j];
-        }
-        oFile << '\n'; //////////////////////////////////////////////////////////
-        for (int j = 0; j < _fVecR[i].size(); j++) {
-            oFile << _fVecR[i][j] << ' ' << _fVecRijk[i][j][0] << ' ' << _fVecRijk[i][j][1] << ' ' << _fVecRijk[i][j][2];
-            if (j < _fVecR[i].size() - 1) oFile << ' ';
-        }
-        oFile << '\n'; //////////////////////////////////////////////////////////
+    // write collapses to string. Streamed collapses are copied from the spill file first, since they came first
+    if (_collapseFile.is_open()) {
+        _collapseFile.flush();
+        ifstream spillFile(_collapseFileName, ios::binary);
+        if (spillFile.peek() != ifstream::traits_type::eof()) oFile << spillFile.rdbuf();
+    }
+    for (int i = 0; i < (int)_collapses.size(); i++) _writeCollapse(oFile, i);
+    oFile.close();
+}
+void MeshObject::makeSimplifiedMeshFile(const string& oFileName) {
+    vector<int> indices = _optimizedIndices();
+    vector<int> remap = optimizeVertexFetch(indices, _vertexPositions.size());
+    vector<vec3> positions;
+    for (int v = 0; v < (int)remap.size(); v++) {
+        if (remap[v] == -1) continue;
+        if (remap[v] >= (int)positions.size()) positions.resize(remap[v] + 1);
+        positions[remap[v]] = _vertexPositions[v];
+    }
+    writeOFF(oFileName, positions, indices);
+}
+void MeshObject::makeLODFiles(const vector<float>& thresholds, const int& thresholdType, const bool& sharedVertices) {
+    if (_format != "off") {
+        printf("LOD files are made while simplifying a .off mesh\n");
+        return;
+    }
+    string prefix = _iFileName.substr(0, _iFileName.rfind('.'));
+    int nFull = nVertices();
+    vector<vec3> shared; // sharedVertices: every position any level uses, each written once
+    vector<int> slot(_vertexPositions.size(), -1); // where vertex v's current position sits in shared
+    vector<vector<int>> levels;
+    for (int level = 0; level < (int)thresholds.size(); level++) {
+        // keep simplifying until this level's threshold is reached. the levels continue from each other, so the whole chain costs one pass
+        while (_pairs.size() > 0) {
+            if (thresholdType == LOD_BY_VERTEX_FRACTION && _adjacency.size() <= thresholds[level] * nFull) break;
+            if (thresholdType == LOD_BY_QUADRIC_ERROR && nextCollapseError() > thresholds[level]) break;
+            quadricSimplify();
+        }
+        printf("LOD %i: %i vertices, %i faces\n", level, (int)_adjacency.size(), nVisibleFaces());
+        vector<int> indices = _optimizedIndices();
+        if (sharedVertices == false) {
+            vector<int> remap = optimizeVertexFetch(indices, _vertexPositions.size());
+            vector<vec3> positions;
+            for (int v = 0; v < (int)remap.size(); v++) {
+                if (remap[v] == -1) continue;
+                if (remap[v] >= (int)positions.size()) positions.resize(remap[v] + 1);
+                positions[remap[v]] = _vertexPositions[v];
+            }
+            writeOFF(prefix + "_lod" + to_string(level) + ".off", positions, indices);
+            continue;
+        }
+        for (int i = 0; i < (int)indices.size(); i++) {
+            int v = indices[i];
+            if (slot[v] == -1 || shared[slot[v]] != _vertexPositions[v]) { // collapses move v0, so it needs a new copy
+                slot[v] = shared.size();
+                shared.push_back(_vertexPositions[v]);
+            }
+            indices[i] = slot[v];
+        }
+        levels.push_back(indices);
+    }
+    if (sharedVertices == false) return;
+    // order the shared buffer by first use, finest level first, and write every level against it
+    vector<int> all;
+    for (int level = 0; level < (int)levels.size(); level++) all.insert(all.end(), levels[level].begin(), levels[level].end());
+    vector<int> remap = optimizeVertexFetch(all, shared.size());
+    vector<vec3> positions(shared.size());
+    for (int v = 0; v < (int)shared.size(); v++) positions[remap[v]] = shared[v];
+    string oFileName = prefix + ".offlod";
+    printf("Writing %i shared vertices and %i levels to %s\n", (int)positions.size(), (int)levels.size(), oFileName.c_str());
+    ofstream oFile;
+    oFile.open(oFileName);
+    oFile << "OFFLOD\n";
+    oFile << positions.size() << ' ' << levels.size() << '\n';
+    for (int i = 0; i < (int)positions.size(); i++) {
+        oFile << positions[i][0] << ' ' << positions[i][1] << ' ' << positions[i][2] << '\n';
+    }
+    int offset = 0;
+    for (int level = 0; level < (int)levels.size(); level++) {
+        int nF = levels[level].size() / 3;
+        oFile << nF << '\n';
+        for (int i = offset; i < offset + 3 * nF; i += 3) {
+            oFile << 3 << ' ' << all[i + 0] << ' ' << all[i + 1] << ' ' << all[i + 2] << '\n';
+        }
+        offset += 3 * nF;
+    }
+    oFile.close();
+}
+vector<int> MeshObject::_optimizedIndices() {
+    vector<int> visFaceIndices = visibleFaces();
+    vector<int> indices(3 * visFaceIndices.size());
+    for (int i = 0; i < (int)visFaceIndices.size(); i++) {
+        for (int k = 0; k < 3; k++) indices[3 * i + k] = _triangleIndices[3 * visFaceIndices[i] + k];
+    }
+    pair<float, float> before = vertexCacheStats(indices);
+    optimizeVertexCache(indices, _vertexPositions.size());
+    pair<float, float> after = vertexCacheStats(indices);
+    printf("  vertex cache ACMR %f -> %f, ATVR %f -> %f\n", before.first, after.first, before.second, after.second);
+    return indices;
+}
+void MeshObject::writeOFF(const string& oFileName, const vector<vec3>& positions, const vector<int>& indices) {
+    printf("Writing %i vertices and %i faces to %s\n", (int)positions.size(), (int)indices.size() / 3, oFileName.c_str());
+    ofstream oFile;
+    oFile.open(oFileName);
+    oFile << "OFF\n";
+    oFile << positions.size() << ' ' << indices.size() / 3 << ' ' << 0 << '\n';
+    for (int i = 0; i < (int)positions.size(); i++) {
+        oFile << positions[i][0] << ' ' << positions[i][1] << ' ' << positions[i][2] << '\n';
+    }
+    for (int i = 0; i < (int)indices.size(); i += 3) {
+        oFile << 3 << ' ' << indices[i + 0] << ' ' << indices[i + 1] << ' ' << indices[i + 2] << '\n';
     }
     oFile.close();
 }
+void MeshObject::_writeCollapse(ostream& oFile, const int& i) {
+    const Collapse& c = _collapses[i];
+    vec3 n0(0, 0, 0), n1(0, 0, 0), n(0, 0, 0);
+    if (_collapseNormals.size() > 0) {
+        n0 = _collapseNormals[3 * i + 0];
+        n1 = _collapseNormals[3 * i + 1];
+        n = _collapseNormals[3 * i + 2];
+    }
+    const int* fVec = _fVec(c);
+    const int* fVec1 = _fVec1(c);
+    const int* fVecR = _fVecR(c);
+    const int* fVecRijk = _fVecRijk(c);
+    oFile << c._v0 << ' ';
+    oFile << c._xyz0[0] << ' ' << c._xyz0[1] << ' ' << c._xyz0[2] << ' ';
+    oFile << n0[0] << ' ' << n0[1] << ' ' << n0[2] << ' ';
+    oFile << c._xyz[0] << ' ' << c._xyz[1] << ' ' << c._xyz[2] << ' ';
+    oFile << n[0] << ' ' << n[1] << ' ' << n[2];
+    for (int j = 0; j < c._nF; j++) {
+        oFile << ' ' << fVec[j];
+    }
+    oFile << '\n'; //////////////////////////////////////////////////////////
+    oFile << c._v1 << ' ';
+    oFile << c._xyz1[0] << ' ' << c._xyz1[1] << ' ' << c._xyz1[2] << ' ';
+    oFile << n1[0] << ' ' << n1[1] << ' ' << n1[2];
+    for (int j = 0; j < c._nF1; j++) {
+        oFile << ' ' << fVec1[j];
+    }
+    oFile << '\n'; //////////////////////////////////////////////////////////
+    for (int j = 0; j < c._nFR; j++) {
+        oFile << fVecR[j] << ' ' << fVecRijk[3 * j + 0] << ' ' << fVecRijk[3 * j + 1] << ' ' << fVecRijk[3 * j + 2];
+        if (j < c._nFR - 1) oFile << ' ';
+    }
+    oFile << '\n'; //////////////////////////////////////////////////////////
+    oFile << c._error << '\n';
+}
+void MeshObject::_streamCollapses() { // append the in-memory collapse records to the spill file and forget them
+    if (!_collapseFile.is_open()) {
+        _collapseFileName = _oFileName + ".collapses";
+        _collapseFileBuffer.resize(1 << 20);
+        _collapseFile.rdbuf()->pubsetbuf(&_collapseFileBuffer[0], _collapseFileBuffer.size());
+        _collapseFile.open(_collapseFileName, ios::binary | ios::trunc);
+        if (!_collapseFile.is_open()) {
+            printf("ERROR: Could not open %s. Keeping collapses in memory.\n", _collapseFileName.c_str());
+            _streamingCollapses = false;
+            return;
+        }
+    }
+    for (int i = 0; i < (int)_collapses.size(); i++) _writeCollapse(_collapseFile, i);
+    _collapses.clear();
+    _collapseFaces.clear();
+    _collapseNormals.clear();
+}
 
 
-void MeshObject::readGeom() {
+void MeshObject::readGeom(const bool& prepare) {
     string file = _iFileName;
     string line;
     ifstream modelfile(_iFileName);
@@ -436,7 +1180,7 @@ void MeshObject::readGeom() {
     if (line == "OFF") {
         _drawVertexNormals = true;
         _format = "off";
-        readGeomOFF();
+        readGeomOFF(prepare);
     }
     else if (line == "OFFPM") {
         _drawVertexNormals = true;
@@ -444,8 +1188,9 @@ void MeshObject::readGeom() {
         readGeomOFFPM();
     }
     else printf("ERROR: Mesh File Type Unrecognized\n");
+    invalidateBounds();
 }
-void MeshObject::readGeomOFF(){
+void MeshObject::readGeomOFF(const bool& prepare){
     printf("------------------------- READING .OFF FILE -------------------------\n");
     string file = _iFileName;
     string line;
@@ -466,12 +1211,11 @@ void MeshObject::readGeomOFF(){
     _pairs.reserve(3 * nF); // for a closed mesh we give twice the leeway since _pairs includes out-of-date pairs
     _partners.resize(nV);
     _quadrics.resize(nV);
-    _vertexPositions.resize(2 * nV, vec3(0, 0, 0));
-    _vertexNormals.resize(2 * nV, vec3(0, 0, 0));
-    _vertexColors.resize(2 * nV, vec4(0, 0, 0, 0));
+    _vertexPositions.resize(nV, vec3(0, 0, 0));
+    _vertexNormals.resize(nV, vec3(0, 0, 0));
+    _vertexColors.resize(nV, vec4(0, 0, 0, 0));
     _faces.resize(nF, { 0, 0, 0 });
     _triangleIndices.resize(3 * nF, 0);
-    _lineIndices.resize(2 * nF, 0);
     _faceNormals.resize(nF, vec3(0, 0, 0));
     _faceAreas.resize(nF, 0);
     _xMin = 0;
@@ -496,8 +1240,6 @@ void MeshObject::readGeomOFF(){
             if (y > _yMax) _yMax = y;
             if (z > _zMax) _zMax = z;
         }
-        _lineIndices[2 * i + 0] = i;
-        _lineIndices[2 * i + 1] = nV + i;
         _vertexPositions[i] = vec3(x, y, z);
         _vertexColors[i] = vec4(1, 1, 1, 1);
     }
@@ -524,6 +1266,9 @@ void MeshObject::readGeomOFF(){
         dAvg += d;
     }
     printf("We're on face %i/%i\n", nF, nF);
+    _geomReady = true;
+    _buffersReady = false;
+    if (prepare == false) return;
     printf("PROCESSING: Vertex/Face Normals\n");
     reComputeVertexNormals();
     printf("            Vertex Quadrics\n");
@@ -532,11 +1277,55 @@ void MeshObject::readGeomOFF(){
     _t = -1;
     setT(0.0 * dAvg);
     printf("---------------------------------------------------------------------\n");
+}
+void MeshObject::setGeom(const vector<vec3>& positions, const vector<int>& indices) { // readGeomOFF from memory and without the progress output
+    int nV = positions.size();
+    int nF = indices.size() / 3;
+    _format = "off";
+    _verbose = false;
+    invalidateBounds();
+    _dummy.resize(nV);
+    _complexity = nV;
+    _nCollapses = 0;
+    _lastUpdate.resize(nV, _nCollapses);
+    _pairs.reserve(3 * nF);
+    _partners.resize(nV);
+    _quadrics.resize(nV);
+    _locked.resize(nV, false);
+    _vertexPositions.resize(nV, vec3(0, 0, 0));
+    _vertexNormals.resize(nV, vec3(0, 0, 0));
+    _vertexColors.resize(nV, vec4(1, 1, 1, 1));
+    _faces.resize(nF, { 0, 0, 0 });
+    _triangleIndices.resize(3 * nF, 0);
+    _faceNormals.resize(nF, vec3(0, 0, 0));
+    _faceAreas.resize(nF, 0);
+    _faceNormalsReady = false;
+    _quadricsReady = false;
+    for (int i = 0; i < nV; i++) _vertexPositions[i] = positions[i];
+    _xMin = _xMax = nV > 0 ? positions[0][0] : 0;
+    _yMin = _yMax = nV > 0 ? positions[0][1] : 0;
+    _zMin = _zMax = nV > 0 ? positions[0][2] : 0;
+    for (int i = 0; i < nV; i++) {
+        _xMin = fmin(_xMin, positions[i][0]);
+        _xMax = fmax(_xMax, positions[i][0]);
+        _yMin = fmin(_yMin, positions[i][1]);
+        _yMax = fmax(_yMax, positions[i][1]);
+        _zMin = fmin(_zMin, positions[i][2]);
+        _zMax = fmax(_zMax, positions[i][2]);
+    }
+    for (int i = 0; i < nF; i++) {
+        _faces[i] = { indices[3 * i + 0], indices[3 * i + 1], indices[3 * i + 2] };
+        for (int k = 0; k < 3; k++) {
+            _triangleIndices[3 * i + k] = indices[3 * i + k];
+            _adjacency[indices[3 * i + k]].insert(i);
+        }
+    }
+    reComputeVertexNormals();
+    reComputeQuadrics();
+    _t = -1;
+    setT(0);
     _geomReady = true;
-    /*for (int i = 0; i < nVertices(); i++) {
-        _vertexPositions[i + nVertices()] = _vertexPositions[i] + dAvg*_vertexNormals[i];
-    }*/
-
+    _buffersReady = false;
 }
 void MeshObject::readGeomOFFPM() {
     int lineNumber = 0;
@@ -561,6 +1350,7 @@ void MeshObject::readGeomOFFPM() {
     int nV = pl[0];
     int nF = pl[1];
     int nC = pl[2];
+    bool hasErrors = pl.size() > 3 && pl[3] == 1; // older files have no error lines
     int _nVcollapsed = pl[0];
     int _nFcollapsed = pl[1];
     int printStepV = ceil((float)nV / 100);
@@ -589,6 +1379,7 @@ void MeshObject::readGeomOFFPM() {
     float yMax = 0;
     float zMin = 0;
     float zMax = 0;
+    vector<int> vBase(nV), fBase(nF); // the vertices and faces of the base mesh, in file order
     for (int i = 0; i < nV; i++){
         if (i%printStepV == 0) printf("We're on vertex %i/%i\r", i + 1, nV);
         getline(modelfile, line);
@@ -610,6 +1401,7 @@ void MeshObject::readGeomOFFPM() {
             if (y > yMax) yMax = y;
             if (z > zMax) zMax = z;
         }
+        vBase[i] = v;
         _vertexPositions[v] = vec3(x, y, z);
         if (nx == INFINITY || ny == INFINITY || nz == INFINITY || nx == -INFINITY || ny == -INFINITY || nz == -INFINITY) _vertexNormals[v] = vec3(0, 0, 0);
         else _vertexNormals[v] = vec3(nx, ny, nz);
@@ -624,66 +1416,75 @@ void MeshObject::readGeomOFFPM() {
         int v0 = pl[1];
         int v1 = pl[2];
         int v2 = pl[3];
+        fBase[i] = f;
         _faces[f] = { v0, v1, v2 };
         _triangleIndices[3 * f + 0] = v0;
         _triangleIndices[3 * f + 1] = v1;
         _triangleIndices[3 * f + 2] = v2;
     }
     printf("We're on face %i/%i\r", nF, nF);
-    _v0.reserve(nC);
-    _v1.reserve(nC);
-    _n0.reserve(nC);
-    _n1.reserve(nC);
-    _n.reserve(nC);
-    _xyz0.reserve(nC);
-    _xyz1.reserve(nC);
-    _xyz.reserve(nC);
-    _fVec.reserve(nC);
-    _fVec1.reserve(nC);
-    _fVecR.reserve(nC);
-    _fVecRijk.reserve(nC);
-    vector<int> f;
+    _collapses.reserve(nC);
+    _collapseFaces.reserve(16 * nC); // roughly 6 + 4 + 2 + 2*3 faces per collapse on a closed mesh
+    if (_recomputeCollapseNormals == false) _collapseNormals.reserve(3 * nC);
+    vector<int> fVec;
     cout << endl;
     for (int i = 0; i < nC; i++){
         if (i%printStepC == 0) printf("We're on collapse %i/%i\r", i + 1, nC);
+        Collapse c;
+        vec3 n0, n1, n;
         getline(modelfile, line); /////
         lineNumber++;
         pl = parseLine(line, ' ');
-        _v0.push_back(pl[0]);
-        _xyz0.push_back(vec3(pl[1], pl[2], pl[3]));
-        if (pl[4] == INFINITY || pl[5] == INFINITY || pl[6] == INFINITY || pl[4] == -INFINITY || pl[5] == -INFINITY || pl[6] == -INFINITY) _n0.push_back(vec3(0, 0, 0));
-        else _n0.push_back(vec3(pl[4], pl[5], pl[6]));
-        _xyz.push_back(vec3(pl[7], pl[8], pl[9]));
-        if (pl[10] == INFINITY || pl[11] == INFINITY || pl[12] == -INFINITY || pl[10] == -INFINITY || pl[11] == -INFINITY || pl[12] == INFINITY) _n.push_back(vec3(0, 0, 0));
-        else _n.push_back(vec3(pl[10], pl[11], pl[12]));
-        f.clear();
-        for (int j = 13; j < pl.size(); j++) f.push_back(pl[j]);
-        _fVec.push_back(f);
+        c._v0 = pl[0];
+        c._xyz0 = vec3(pl[1], pl[2], pl[3]);
+        if (pl[4] == INFINITY || pl[5] == INFINITY || pl[6] == INFINITY || pl[4] == -INFINITY || pl[5] == -INFINITY || pl[6] == -INFINITY) n0 = vec3(0, 0, 0);
+        else n0 = vec3(pl[4], pl[5], pl[6]);
+        c._xyz = vec3(pl[7], pl[8], pl[9]);
+        if (pl[10] == INFINITY || pl[11] == INFINITY || pl[12] == -INFINITY || pl[10] == -INFINITY || pl[11] == -INFINITY || pl[12] == INFINITY) n = vec3(0, 0, 0);
+        else n = vec3(pl[10], pl[11], pl[12]);
+        fVec.clear();
+        for (int j = 13; j < (int)pl.size(); j++) fVec.push_back(pl[j]);
         getline(modelfile, line); /////
         lineNumber++;
         pl = parseLine(line, ' ');
-        _v1.push_back(pl[0]);
-        _xyz1.push_back(vec3(pl[1], pl[2], pl[3]));
-        if (pl[4] == INFINITY || pl[5] == INFINITY || pl[6] == INFINITY || pl[4] == -INFINITY || pl[5] == -INFINITY || pl[6] == -INFINITY) _n1.push_back(vec3(0, 0, 0));
-        else _n1.push_back(vec3(pl[4], pl[5], pl[6]));
-        f.clear();
-        for (int j = 7; j < pl.size(); j++) f.push_back(pl[j]);
-        _fVec1.push_back(f);
+        c._v1 = pl[0];
+        c._xyz1 = vec3(pl[1], pl[2], pl[3]);
+        if (pl[4] == INFINITY || pl[5] == INFINITY || pl[6] == INFINITY || pl[4] == -INFINITY || pl[5] == -INFINITY || pl[6] == -INFINITY) n1 = vec3(0, 0, 0);
+        else n1 = vec3(pl[4], pl[5], pl[6]);
+        c._f = _collapseFaces.size();
+        for (int j = 7; j < (int)pl.size(); j++) _collapseFaces.push_back(pl[j]);
+        c._nF1 = _collapseFaces.size() - c._f;
         getline(modelfile, line); /////
         lineNumber++;
         pl = parseLine(line, ' ');
-        f.clear();
-        vector<vector<int>> ijk;
+        c._nFR = pl.size() / 4;
+        for (int j = 0; j < (int)pl.size(); j += 4) _collapseFaces.push_back(pl[j + 0]);
         for (int j = 0; j < pl.size(); j += 4){
-            f.push_back(pl[j + 0]);
-            ijk.push_back({ (int)pl[j + 1], (int)pl[j + 2], (int)pl[j + 3] });
+            _collapseFaces.push_back(pl[j + 1]);
+            _collapseFaces.push_back(pl[j + 2]);
+            _collapseFaces.push_back(pl[j + 3]);
+        }
+        c._nF = fVec.size();
+        _collapseFaces.insert(_collapseFaces.end(), fVec.begin(), fVec.end());
+        c._error = -1;
+        if (hasErrors == true) {
+            getline(modelfile, line); /////
+            lineNumber++;
+            c._error = stof(line);
         }
-        _fVecR.push_back(f);
-        _fVecRijk.push_back(ijk);
+        _collapses.push_back(c);
+        if (_recomputeCollapseNormals == true) continue;
+        _collapseNormals.push_back(n0);
+        _collapseNormals.push_back(n1);
+        _collapseNormals.push_back(n);
     }
     printf("We're on collapse %i/%i\n", nC, nC);
-    printf("-----------------------------------------------------------------------\n");
+    _makePrefixOrder(vBase, fBase);
+    _buildErrorCurve();
     _geomReady = true;
+    _buffersReady = false;
+    if (_checkpointBudget > 0) _buildCheckpoints();
+    printf("-----------------------------------------------------------------------\n");
 }
 pair<int, int> MeshObject::randomEdge() {
     if (_adjacency.size() == 0) return pair<int, int>({ -1, -1 });
@@ -729,72 +1530,123 @@ pair<int, int> MeshObject::randomEdge() {
 
 void MeshObject::collapse(const int& v0, const int& v1) { collapse(v0, v1, _approximationMethod); }
 void MeshObject::collapse(const int& v0, const int& v1, const int& approximationMethod) { // the former vertex is kept. the latter is discarded from adjacency
+    vector<int> vFinVec;
+    if (_collapse(v0, v1, approximationMethod, vFinVec) == false) return;
+    if (_allowFins == true) return;
+    // remove the fins if any exist. Each fin is collapsed into v0, which may expose new fins around v0, so we keep
+    // a stack of (candidate fin vertices, next candidate) and always finish the newest collapse's candidates first.
+    // This visits the fins in exactly the order the old recursive collapse(v0, vFin) did, so the history is unchanged.
+    vector<pair<vector<int>, int>> worklist;
+    worklist.push_back(pair<vector<int>, int>(vFinVec, 0));
+    while (!worklist.empty()) {
+        if (worklist.back().second == (int)worklist.back().first.size()) {
+            worklist.pop_back();
+            continue;
+        }
+        int vFin = worklist.back().first[worklist.back().second];
+        worklist.back().second++;
+        if (_isFin(v0, vFin) == false) continue;
+        if (_isLocked(vFin) == true) continue;
+        vFinVec.clear();
+        if (_collapse(v0, vFin, BINARY_APPROXIMATION_METHOD, vFinVec)) worklist.push_back(pair<vector<int>, int>(vFinVec, 0));
+    }
+}
+bool MeshObject::_isFin(const int& v0, const int& vFin) { // two consecutive faces around v0 that span the same triangle v0,vFin,u
+    const set<int>& fSet0 = _adjacency[v0];
+    int uFin = -1; // the third vertex index of the fin
+    for (set<int>::const_iterator f = fSet0.begin(); f != fSet0.end(); f++) {
+        const Face& corners = _faces[*f];
+        for (int j = 0; j < 3; j++) {
+            if (corners[j] != vFin) continue;
+            int u = 0;
+            if (corners[(j + 1) % 3] == v0) u = corners[(j + 2) % 3];
+            else u = corners[(j + 1) % 3];
+            if (u == uFin) return true;
+            uFin = u;
+            break;
+        }
+    }
+    return false;
+}
+bool MeshObject::_flipsFace(const int& v0, const int& v1, const vec3& position) {
+    for (int k = 0; k < 2; k++) {
+        int v = k == 0 ? v0 : v1;
+        int other = k == 0 ? v1 : v0;
+        const set<int>& fSet = _adjacency[v];
+        for (set<int>::const_iterator f = fSet.begin(); f != fSet.end(); f++) {
+            const Face& corners = _faces[*f];
+            if (corners[0] == other || corners[1] == other || corners[2] == other) continue; // shared faces are removed
+            vec3 p[3], q[3];
+            for (int c = 0; c < 3; c++) {
+                p[c] = _vertexPositions[corners[c]];
+                q[c] = corners[c] == v ? position : p[c];
+            }
+            if (dot(cross(p[1] - p[0], p[2] - p[0]), cross(q[1] - q[0], q[2] - q[0])) < 0) return true;
+        }
+    }
+    return false;
+}
+bool MeshObject::_keepsManifold(const int& v0, const int& v1) {
+    set<int> opposite, neighbors0; // corners of the shared faces, and everything around v0
+    const set<int>& fSet0 = _adjacency[v0];
+    for (set<int>::const_iterator f = fSet0.begin(); f != fSet0.end(); f++) {
+        const Face& corners = _faces[*f];
+        bool shared = corners[0] == v1 || corners[1] == v1 || corners[2] == v1;
+        for (int c = 0; c < 3; c++) {
+            if (corners[c] == v0 || corners[c] == v1) continue;
+            neighbors0.insert(corners[c]);
+            if (shared == true) opposite.insert(corners[c]);
+        }
+    }
+    const set<int>& fSet1 = _adjacency[v1];
+    for (set<int>::const_iterator f = fSet1.begin(); f != fSet1.end(); f++) {
+        const Face& corners = _faces[*f];
+        for (int c = 0; c < 3; c++) {
+            if (neighbors0.count(corners[c]) > 0 && opposite.count(corners[c]) == 0) return false;
+        }
+    }
+    return true;
+}
+bool MeshObject::_collapse(const int& v0, const int& v1, const int& approximationMethod, vector<int>& vFinVec) {
     if (v0 == -1 && v1 == -1) {
         printf("WARNING: No edges remain.\n");
-        return;
+        return false;
     }
     if (_adjacency.size() < 2) {
         printf("WARNING: No more pairs to collapse.\n");
-        return;
-    }
-    if (_adjacency.size() < 4) {
-        for (map<int, set<int>>::iterator it = _adjacency.begin(); it != _adjacency.end(); it++) {
-            _lineIndices[2 * it->first + 0] = 0;
-            _lineIndices[2 * it->first + 1] = 0;
-        }
+        return false;
     }
-    int adjInSize = _adjacency.size();
-    map<int, set<int>> adjIn = _adjacency;
     _nCollapses++;
     _lastUpdate[v0] = _nCollapses;
     _lastUpdate[v1] = _nCollapses;
-    _v0.push_back(v0);
-    _v1.push_back(v1);
-    _xyz0.push_back(_vertexPositions[v0]);
-    _xyz1.push_back(_vertexPositions[v1]);
-    _n0.push_back(_vertexNormals[v0]);
-    _n1.push_back(_vertexNormals[v1]);
-    _lineIndices[2 * v1 + 0] = 0;
-    _lineIndices[2 * v1 + 1] = 0;
+    Collapse record;
+    record._v0 = v0;
+    record._v1 = v1;
+    record._xyz0 = _vertexPositions[v0];
+    record._xyz1 = _vertexPositions[v1];
+    record._error = _collapseError;
+    _collapseNormals.push_back(_vertexNormals[v0]);
+    _collapseNormals.push_back(_vertexNormals[v1]);
     _vertexPositions[v0] = mergedCoordinates(v0, v1, approximationMethod);
-    _xyz.push_back(_vertexPositions[v0]);
-    set<int> fSet0 = _adjacency[v0];
-    set<int> fSet1 = _adjacency[v1];
-    set<int> fUnion, fIntersect; // shared faces along edge (typically two unless mesh isn't "closed")
-    set<int> fDis0 = fSet0;
-    set<int> fDis1 = fSet1;
+    _markVertexDirty(v0);
+    record._xyz = _vertexPositions[v0];
+    const set<int>& fSet0 = _adjacency[v0];
+    const set<int>& fSet1 = _adjacency[v1];
+    vector<int> fShared; // shared faces along edge (typically two unless mesh isn't "closed")
+    vector<int> fDis1; // faces of v1 that are not shared with v0
+    set_intersection(fSet0.begin(), fSet0.end(), fSet1.begin(), fSet1.end(), back_inserter(fShared));
+    set_difference(fSet1.begin(), fSet1.end(), fShared.begin(), fShared.end(), back_inserter(fDis1));
+    record._f = _collapseFaces.size();
+    record._nF1 = fDis1.size();
+    record._nFR = fShared.size();
+    _collapseFaces.insert(_collapseFaces.end(), fDis1.begin(), fDis1.end());
+    _collapseFaces.insert(_collapseFaces.end(), fShared.begin(), fShared.end());
+    for (int i = 0; i < (int)fShared.size(); i++) _collapseFaces.insert(_collapseFaces.end(), _faces[fShared[i]].begin(), _faces[fShared[i]].end());
 
-    fUnion = fSet1;
-    for (set<int>::iterator f0 = fSet0.begin(); f0 != fSet0.end(); f0++){
-        bool uniqueFlag = true;
-        for (set<int>::iterator f1 = fSet1.begin(); f1 != fSet1.end(); f1++){
-            if (*f0 == *f1) {
-                fIntersect.insert(*f1);
-                fDis0.erase(*f1);
-                fDis1.erase(*f1);
-                uniqueFlag = false;
-                break;
-            }
-        }
-        if (uniqueFlag == true) fUnion.insert(*f0);
-    }
-    _fVec1.push_back(vector<int>(fDis1.begin(), fDis1.end()));
-    vector<int> fShared = vector<int>(fIntersect.begin(), fIntersect.end());
-    _fVecR.push_back(fShared);
-    vector<vector<int>> ijk;
-    for (int i = 0; i < fShared.size(); i++) ijk.push_back(_faces[fShared[i]]);
-    _fVecRijk.push_back(ijk);
-
-    /*printf("collapsing %i %i\n", v0, v1);
-    Sphere* sphere = new Sphere(0.01,20,20);
-    sphere->setTx(_xyz.back()[0] + (_xMin + _xMax) / 2);
-    sphere->setTy(_xyz.back()[1] + (_yMin + _yMax) / 2);
-    sphere->setTz(_xyz.back()[2] + (_zMin + _zMax) / 2);
-    _world->addObject(sphere);*/
     _partners[v0].erase(v1);
     _partners[v1].erase(v0);
     set<int> vSet1;
-    for (set<int>::iterator f = fSet1.begin(); f != fSet1.end(); f++) {
+    for (set<int>::const_iterator f = fSet1.begin(); f != fSet1.end(); f++) {
         for (int i = 0; i < 3; i++) {
             if (_faces[*f][i] == v0 || _faces[*f][i] == v1) continue;
             vSet1.insert(_faces[*f][i]);
@@ -806,43 +1658,34 @@ void MeshObject::collapse(const int& v0, const int& v1, const int& approximation
         _partners[v0].insert(*v);
     }
 
-
-    /*for (int i = 0; i < nVertices(); i++) {
-        printf("\n%i: ", i);
-        for (set<int>::iterator it = _partners[i].begin(); it != _partners[i].end(); it++){
-            printf("%i ", *it);
-        }
-    }
-    printf("\n");*/
-
-
-    vector<int> vFinVec; // the third vertices (!=v0 && !=v1) of the shared faces
-    for (set<int>::iterator f = fIntersect.begin(); f != fIntersect.end(); f++) { // For each of the shared faces
-        _triangleIndices[3 * (*f) + 0] = 0; // Make the shared face degenerate in the index buffer so it doesn't get drawn
-        _triangleIndices[3 * (*f) + 1] = 0;
-        _triangleIndices[3 * (*f) + 2] = 0;
-        for (int corner = 0; corner < 3; corner++) { // For each vertex that is connected to the shared face _faces[*f][v] ...
-            set<int>::iterator it = _adjacency[_faces[*f][corner]].find(*f); // Remove the shared face *f from that vertex's list of adjacent faces
-            if (it != _adjacency[_faces[*f][corner]].end()) _adjacency[_faces[*f][corner]].erase(it);
-            if (_faces[*f][corner] != v0 &&_faces[*f][corner] != v1) vFinVec.push_back(_faces[*f][corner]);
+    vFinVec.clear(); // the third vertices (!=v0 && !=v1) of the shared faces
+    for (int i = 0; i < (int)fShared.size(); i++) { // For each of the shared faces
+        int f = fShared[i];
+        _triangleIndices[3 * f + 0] = 0; // Make the shared face degenerate in the index buffer so it doesn't get drawn
+        _triangleIndices[3 * f + 1] = 0;
+        _triangleIndices[3 * f + 2] = 0;
+        _markFaceDirty(f);
+        for (int corner = 0; corner < 3; corner++) { // For each vertex that is connected to the shared face _faces[f][v] ...
+            _adjacency[_faces[f][corner]].erase(f); // Remove the shared face f from that vertex's list of adjacent faces
+            if (_faces[f][corner] != v0 &&_faces[f][corner] != v1) vFinVec.push_back(_faces[f][corner]);
         }
     }
 
     // change all associations of faces adjacent to v1 from "v1 to v0"
-    fSet1 = _adjacency[v1]; // this is important. we don't want to change _faces[fIntersect], since we need it later for writing to ProgMesh file
-    for (set<int>::iterator f = fSet1.begin(); f != fSet1.end(); f++) {
+    // fSet1 no longer holds the shared faces. this is important. we don't want to change _faces[fShared], since we need it later for writing to ProgMesh file
+    for (set<int>::const_iterator f = fSet1.begin(); f != fSet1.end(); f++) {
         for (int corner = 0; corner < 3; corner++) {
             if (_faces[*f][corner] != v1) continue;
             _faces[*f][corner] = v0;
             _triangleIndices[3 * (*f) + corner] = v0;
+            _markFaceDirty(*f);
             _adjacency[v0].insert(*f); // DON'T FORGET TO ADD V1's NEIGHBORS TO V0's ADJACENCY
         }
     }
     _adjacency.erase(v1); // Remove v1 from the _adjacency list
     // Update normals for FACES adjacent to v0
-    fSet0 = _adjacency[v0];
     set<int> vSet0;
-    for (set<int>::iterator f = fSet0.begin(); f != fSet0.end(); f++) {
+    for (set<int>::const_iterator f = fSet0.begin(); f != fSet0.end(); f++) {
         vec3 p[3] = { _vertexPositions[_faces[*f][0]], _vertexPositions[_faces[*f][1]], _vertexPositions[_faces[*f][2]] };
         for (int c = 0; c < 3; c++) vSet0.insert(_faces[*f][c]);
         vec3 n = cross(p[1] - p[0], p[2] - p[0]);
@@ -853,79 +1696,19 @@ void MeshObject::collapse(const int& v0, const int& v1, const int& approximation
     // Update normals for VERTICES adjacent to above faces (including v0 itself)
     for (set<int>::iterator v = vSet0.begin(); v != vSet0.end(); v++) {
         vec3 n(0, 0, 0);
-        float nScale = 0;
-        for (set<int>::iterator fs = _adjacency[*v].begin(); fs != _adjacency[*v].end(); fs++) {
-            n += _faceNormals[*fs];
-            nScale += _faceAreas[*fs];
-        }
-        n = normalize(n / (float)_adjacency[*v].size());
-        nScale = sqrt(nScale / (float)_adjacency[*v].size());
-        _vertexNormals[*v] = n;
-        _vertexNormals[*v + nVertices()] = n;
-        _vertexPositions[*v + nVertices()] = _vertexPositions[*v] + nScale*n;
+        for (set<int>::iterator fs = _adjacency[*v].begin(); fs != _adjacency[*v].end(); fs++) n += _faceNormals[*fs];
+        _vertexNormals[*v] = normalize(n / (float)_adjacency[*v].size());
+        _markVertexDirty(*v);
     }
-    _n.push_back(_vertexNormals[v0]);
+    _collapseNormals.push_back(_vertexNormals[v0]);
     // Update the Quadric and Metric Priority Queue
     updateQuadricsAndMetrics(v0, v1, set<int>(vFinVec.begin(), vFinVec.end()));
-    // save the collapse to File (important that this comes BEFORE fin removal, since it is a recursive call)
-    _fVec.push_back(vector<int>(_adjacency[v0].begin(), _adjacency[v0].end()));
-    // FINALLY! remove the fins if any exist ---------------------------------------------
-    if (_allowFins == false) {
-        for (int i = 0; i < vFinVec.size(); i++) {
-            fSet0 = _adjacency[v0];
-            int vFin = vFinVec[i];
-            int uFin = -1; // the third vertex index of the fin
-            int fFin = -1; // the face index of the fin
-            bool finFound = false;
-            for (set<int>::iterator f = fSet0.begin(); f != fSet0.end(); f++) {
-                Face corners = _faces[*f];
-                for (int j = 0; j < 3; j++) {
-                    if (corners[j] != vFin) continue;
-                    int u = 0;
-                    if (corners[(j + 1) % 3] == v0) u = corners[(j + 2) % 3];
-                    else u = corners[(j + 1) % 3];
-                    if (u != uFin) {
-                        uFin = u;
-                        fFin = *f;
-                    }
-                    else {
-                        //printf(" FIN ");
-                        finFound = true;
-                        collapse(v0, vFin, BINARY_APPROXIMATION_METHOD); // to remove fin call collapseEdge(_,_) recursively
-                    }
-                    break;
-                }
-            }
-            if (finFound == true) continue;
-        }
-    }
-
-    /*if (_adjacency.size() != nVertices() - _nCollapses) {
-        printf("IMPOSSIBRU!!!!!! %i %i merged on collapse %i\n", v0, v1, _nCollapses);
-        for (map<int, set<int>>::iterator it = adjIn.begin(); it != adjIn.end(); it++){
-            if (it->first == v1) continue;
-            map<int, set<int>>::iterator it2 = _adjacency.find(it->first);
-            if (it2 == _adjacency.end()) {
-                printf("  vertex %i has gone missing\n", it->first);
-                printf("  initial adjacency for missing vertex %i:", it->first);
-                for (set<int>::iterator it3 = adjIn[it->first].begin(); it3 != adjIn[it->first].end(); it3++) {
-                    printf("  %i", *it3);
-                }
-                printf("\n");
-                printf("  initial adjacency for vertex %i:", v0);
-                for (set<int>::iterator it3 = adjIn[v0].begin(); it3 != adjIn[v0].end(); it3++) {
-                    printf("  %i", *it3);
-                }
-                printf("\n");
-                printf("  initial adjacency for vertex %i:", v1);
-                for (set<int>::iterator it3 = adjIn[v1].begin(); it3 != adjIn[v1].end(); it3++) {
-                    printf("  %i", *it3);
-                }
-                printf("\n");
-            }
-        }
-        system("PAUSE");
-    }*/
+    // save the collapse to File (important that this comes BEFORE fin removal, since fin removal records collapses of its own)
+    record._nF = fSet0.size();
+    _collapseFaces.insert(_collapseFaces.end(), fSet0.begin(), fSet0.end());
+    _collapses.push_back(record);
+    if (_streamingCollapses == true) _streamCollapses();
+    return true;
 }
 
 void MeshObject::collapseRandomEdge(const int& approximationMethod) {
@@ -933,9 +1716,16 @@ void MeshObject::collapseRandomEdge(const int& approximationMethod) {
     collapse(re.first, re.second, approximationMethod);
 }
 
+void MeshObject::resetPairs() {
+    for (int v = 0; v < (int)_partners.size(); v++) _partners[v].clear(); // or setT(0) finds every edge already paired
+    _t = -1; // setT skips a threshold it already has
+    setT(0);
+}
 void MeshObject::setT(const float& t) {
-    printf("Setting distance threshold to %f\n", t);
-    printf("  Updating quadric error metrics between sufficiently close vertices\n");
+    if (_verbose == true) {
+        printf("Setting distance threshold to %f\n", t);
+        printf("  Updating quadric error metrics between sufficiently close vertices\n");
+    }
     if (t == _t) return;
     vector<Edge> pairVec;
     pairVec.reserve(3 * _faces.size() / 2); // reserving more crashes
@@ -954,7 +1744,7 @@ void MeshObject::setT(const float& t) {
                 pairVec.push_back(Edge(u0, u1, metric(u0, u1), _nCollapses, _nCollapses));
             }
             counter++;
-            if (counter % 100 == 0) printf("  %i\r", counter);
+            if (_verbose == true && counter % 100 == 0) printf("  %i\r", counter);
         }
     }
     else if (t > _t) {
@@ -991,7 +1781,7 @@ void MeshObject::setT(const float& t) {
     }
     priority_queue<Edge> pairs = priority_queue<Edge>(pairVec.begin(), pairVec.end());
     swap(_pairs, pairs);
-    printf("  %i collapseable vertex pairs found\n", _pairs.size());
+    if (_verbose == true) printf("  %i collapseable vertex pairs found\n", (int)_pairs.size());
     _t = t;
     /*for (int i = 0; i < nVertices(); i++) {
         printf("\n%i: ", i);
@@ -1064,18 +1854,13 @@ void MeshObject::reComputeVertexNormals() {
     if (_faceNormalsReady == false) reComputeFaceNormals();
     for (map<int, set<int>>::const_iterator i = _adjacency.begin(); i != _adjacency.end(); i++) {
         vec3 n(0, 0, 0);
-        float nScale = 0;
-        set<int> adjFaces = i->second; // adjacent faces
-        for (set<int>::iterator j = adjFaces.begin(); j != adjFaces.end(); j++){
-            n += _faceNormals[*j];
-            nScale += _faceAreas[*j];
-        }
-        n = normalize(n / (float)adjFaces.size());
-        nScale = sqrt(nScale / (float)adjFaces.size());
-        _vertexNormals[i->first] = n;
-        _vertexNormals[i->first + nVertices()] = n;
-        _vertexPositions[i->first + nVertices()] = _vertexPositions[i->first] + nScale*n;
+        const set<int>& adjFaces = i->second; // adjacent faces
+        for (set<int>::const_iterator j = adjFaces.begin(); j != adjFaces.end(); j++) n += _faceNormals[*j];
+        _vertexNormals[i->first] = normalize(n / (float)adjFaces.size());
     }
+    _dirtyPositions.add(0, _vertexPositions.size());
+    _dirtyNormals.add(0, _vertexNormals.size());
+    _bvhDirty = true;
 }
 vec3 MeshObject::mergedCoordinates(const int& v0, const int& v1, const int& approximationMethod) {
     if (approximationMethod == BINARY_APPROXIMATION_METHOD) return _vertexPositions[v0];
@@ -1153,6 +1938,7 @@ void MeshObject::updateQuadricsAndMetrics(const int& v0, const int& v1, const se
 }
 
 int MeshObject::nVisibleFaces() {
+    if (_prefixFaces.size() > 0 && _viewDependent == false) return _prefixFaces[_collapseIndex()];
     int count = 0;
     for (int i = 0; i < _faces.size(); i++) {
         if (_triangleIndices[3 * i + 0] == _triangleIndices[3 * i + 1]) continue;
@@ -1164,6 +1950,11 @@ int MeshObject::nVisibleFaces() {
 }
 vector<int> MeshObject::visibleFaces() {
     vector<int> visFaces;
+    if (_prefixFaces.size() > 0 && _viewDependent == false) {
+        visFaces.resize(_prefixFaces[_collapseIndex()]);
+        for (int i = 0; i < (int)visFaces.size(); i++) visFaces[i] = i;
+        return visFaces;
+    }
     visFaces.reserve(_faces.size());
     for (int i = 0; i < _faces.size(); i++) {
         if (_triangleIndices[3 * i + 0] == _triangleIndices[3 * i + 1]) continue;
@@ -1174,6 +1965,316 @@ vector<int> MeshObject::visibleFaces() {
     return visFaces;
 }
 
+// Binned SAH build in the manner of Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies" (2007). Every face
+// slot gets a lane, hidden or not, so a refit can bring faces back as collapses are undone.
+void TriangleBVH::build(const vector<vec3>& positions, const vector<int>& indices, const int& nFaces) {
+    _nSlots = indices.size() / 3;
+    _nodes.clear();
+    _blocks.clear();
+    _blockFaces.clear();
+    if (_nSlots == 0) return;
+    vector<vec3> lo(_nSlots), hi(_nSlots), centroid(_nSlots);
+    for (int f = 0; f < _nSlots; f++) {
+        const vec3& a = positions[indices[3 * f + 0]];
+        const vec3& b = positions[indices[3 * f + 1]];
+        const vec3& c = positions[indices[3 * f + 2]];
+        lo[f] = min(a, min(b, c));
+        hi[f] = max(a, max(b, c));
+        if (any(isnan(lo[f])) == true || any(isnan(hi[f])) == true) lo[f] = hi[f] = vec3(0, 0, 0); // a stale corner. hidden until a refit
+        centroid[f] = 0.5f*(lo[f] + hi[f]);
+    }
+    vector<int> order(_nSlots);
+    for (int f = 0; f < _nSlots; f++) order[f] = f;
+    struct Range { int _node, _begin, _end, _depth; };
+    vector<Range> todo(1, Range{ 0, 0, _nSlots, 0 });
+    _nodes.push_back(BVHNode());
+    auto area = [](const vec3& lo, const vec3& hi) {
+        vec3 d = max(hi - lo, vec3(0, 0, 0));
+        return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+    };
+    while (todo.empty() == false) {
+        Range r = todo.back();
+        todo.pop_back();
+        int n = r._end - r._begin;
+        if (n <= BVH_LEAF_SIZE) {
+            _nodes[r._node]._first = _blocks.size();
+            _nodes[r._node]._count = n;
+            _blocks.push_back(TriangleBlock());
+            for (int j = 0; j < BVH_LEAF_SIZE; j++) _blockFaces.push_back(j < n ? order[r._begin + j] : -1);
+            continue;
+        }
+        vec3 cLo(INFINITY, INFINITY, INFINITY), cHi = -cLo;
+        for (int i = r._begin; i < r._end; i++) {
+            cLo = min(cLo, centroid[order[i]]);
+            cHi = max(cHi, centroid[order[i]]);
+        }
+        vec3 extent = cHi - cLo;
+        int axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+        int mid = -1;
+        if (extent[axis] > 0 && r._depth < BVH_MAX_DEPTH) {
+            float scale = BVH_BINS / extent[axis] * 0.9999f; // keeps the largest centroid in the last bin
+            auto bin = [&](int f) { return (int)((centroid[f][axis] - cLo[axis]) * scale); };
+            int count[BVH_BINS] = {};
+            vec3 binLo[BVH_BINS], binHi[BVH_BINS];
+            for (int b = 0; b < BVH_BINS; b++) {
+                binLo[b] = vec3(INFINITY, INFINITY, INFINITY);
+                binHi[b] = -binLo[b];
+            }
+            for (int i = r._begin; i < r._end; i++) {
+                int f = order[i], b = bin(f);
+                count[b]++;
+                binLo[b] = min(binLo[b], lo[f]);
+                binHi[b] = max(binHi[b], hi[f]);
+            }
+            float rightCost[BVH_BINS]; // area times count of bins [b, BVH_BINS)
+            vec3 sweepLo(INFINITY, INFINITY, INFINITY), sweepHi = -sweepLo;
+            int sweepCount = 0;
+            for (int b = BVH_BINS - 1; b > 0; b--) {
+                sweepLo = min(sweepLo, binLo[b]);
+                sweepHi = max(sweepHi, binHi[b]);
+                sweepCount += count[b];
+                rightCost[b] = area(sweepLo, sweepHi) * sweepCount;
+            }
+            sweepLo = vec3(INFINITY, INFINITY, INFINITY);
+            sweepHi = -sweepLo;
+            sweepCount = 0;
+            float bestCost = INFINITY;
+            int bestBin = -1;
+            for (int b = 1; b < BVH_BINS; b++) { // split between bins b - 1 and b
+                sweepLo = min(sweepLo, binLo[b - 1]);
+                sweepHi = max(sweepHi, binHi[b - 1]);
+                sweepCount += count[b - 1];
+                if (sweepCount == 0 || sweepCount == n) continue;
+                float cost = area(sweepLo, sweepHi) * sweepCount + rightCost[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestBin = b;
+                }
+            }
+            if (bestBin != -1) mid = partition(order.begin() + r._begin, order.begin() + r._end, [&](int f) { return bin(f) < bestBin; }) - order.begin();
+        }
+        if (mid == -1) { // one centroid, or too deep: halve at the median
+            mid = r._begin + n / 2;
+            nth_element(order.begin() + r._begin, order.begin() + mid, order.begin() + r._end, [&](int f, int g) { return centroid[f][axis] < centroid[g][axis]; });
+        }
+        int children = _nodes.size();
+        _nodes[r._node]._first = children;
+        _nodes[r._node]._count = 0;
+        _nodes.push_back(BVHNode());
+        _nodes.push_back(BVHNode());
+        todo.push_back(Range{ children, r._begin, mid, r._depth + 1 });
+        todo.push_back(Range{ children + 1, mid, r._end, r._depth + 1 });
+    }
+    _nodes.shrink_to_fit(); // a few hundred bytes a face otherwise, on the biggest meshes
+    _blocks.shrink_to_fit();
+    _blockFaces.shrink_to_fit();
+    refit(positions, indices, nFaces);
+}
+void TriangleBVH::_fillLeaf(BVHNode& node, const vector<vec3>& positions, const vector<int>& indices, const int& nFaces) {
+    TriangleBlock& block = _blocks[node._first];
+    const int* faces = &_blockFaces[BVH_LEAF_SIZE * node._first];
+    node._lo = vec3(INFINITY, INFINITY, INFINITY);
+    node._hi = -node._lo;
+    for (int j = 0; j < BVH_LEAF_SIZE; j++) {
+        int f = faces[j];
+        const int* t = f == -1 ? nullptr : &indices[3 * f];
+        bool shown = f != -1 && (nFaces < 0 || f < nFaces) && t[0] != t[1] && t[1] != t[2] && t[2] != t[0];
+        block._face[j] = shown == true ? f : -1;
+        vec3 a, e1, e2; // zero edges never pass the determinant test
+        if (shown == true) {
+            a = positions[t[0]];
+            e1 = positions[t[1]] - a;
+            e2 = positions[t[2]] - a;
+            node._lo = min(node._lo, min(a, min(positions[t[1]], positions[t[2]])));
+            node._hi = max(node._hi, max(a, max(positions[t[1]], positions[t[2]])));
+        }
+        for (int d = 0; d < 3; d++) {
+            block._v0[d][j] = a[d];
+            block._e1[d][j] = e1[d];
+            block._e2[d][j] = e2[d];
+        }
+    }
+}
+void TriangleBVH::refit(const vector<vec3>& positions, const vector<int>& indices, const int& nFaces) {
+    for (int i = _nodes.size() - 1; i >= 0; i--) { // children first, since they always follow their parent
+        BVHNode& node = _nodes[i];
+        if (node._count > 0) {
+            _fillLeaf(node, positions, indices, nFaces);
+            continue;
+        }
+        const BVHNode& a = _nodes[node._first];
+        const BVHNode& b = _nodes[node._first + 1];
+        node._lo = min(a._lo, b._lo); // an empty child's box is inside out, so it drops out here
+        node._hi = max(a._hi, b._hi);
+    }
+}
+namespace {
+bool slab(const BVHNode& node, const vec3& origin, const vec3& inverse, const float& tMax, float& tEnter) {
+    if (node._lo[0] > node._hi[0]) return false; // nothing shown below
+    float t0 = 0, t1 = tMax;
+    for (int d = 0; d < 3; d++) {
+        float a = (node._lo[d] - origin[d]) * inverse[d], b = (node._hi[d] - origin[d]) * inverse[d];
+        t0 = fmax(t0, fmin(a, b)); // fmin and fmax drop the NaN of an axis the ray runs along
+        t1 = fmin(t1, fmax(a, b));
+    }
+    tEnter = t0;
+    return t0 <= t1;
+}
+float boxDistance2(const BVHNode& node, const vec3& p) { // squared, INFINITY for an empty box
+    if (node._lo[0] > node._hi[0]) return INFINITY;
+    vec3 d = max(max(node._lo - p, p - node._hi), vec3(0, 0, 0));
+    return dot(d, d);
+}
+vec3 closestOnTriangle(const vec3& p, const vec3& a, const vec3& b, const vec3& c) { // Ericson, "Real-Time Collision Detection" 5.1.5
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) return a;
+    vec3 bp = p - b;
+    float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+    vec3 cp = p - c;
+    float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    float denominator = 1 / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+}
+bool TriangleBVH::intersect(const vec3& origin, const vec3& direction, RayHit& hit, const float& tMax) const {
+    if (_nodes.empty() == true) return false;
+    vec3 inverse(1 / direction[0], 1 / direction[1], 1 / direction[2]);
+    __m128 o[3], d[3];
+    for (int k = 0; k < 3; k++) {
+        o[k] = _mm_set1_ps(origin[k]);
+        d[k] = _mm_set1_ps(direction[k]);
+    }
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1), epsilon = _mm_set1_ps(1e-12f);
+    float best = tMax;
+    hit._face = -1;
+    int stack[2 * BVH_MAX_DEPTH];
+    int top = 0;
+    float tEnter;
+    if (slab(_nodes[0], origin, inverse, best, tEnter) == true) stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode& node = _nodes[stack[--top]];
+        if (node._count == 0) {
+            float tA, tB;
+            bool a = slab(_nodes[node._first], origin, inverse, best, tA);
+            bool b = slab(_nodes[node._first + 1], origin, inverse, best, tB);
+            if (a == true && b == true && tA < tB) { // the nearer child goes on top
+                stack[top++] = node._first + 1;
+                stack[top++] = node._first;
+            }
+            else {
+                if (a == true) stack[top++] = node._first;
+                if (b == true) stack[top++] = node._first + 1;
+            }
+            continue;
+        }
+        if (slab(node, origin, inverse, best, tEnter) == false) continue; // a nearer hit was found since it was pushed
+        // Moller-Trumbore on four triangles at once
+        const TriangleBlock& block = _blocks[node._first];
+        __m128 e1[3], e2[3], s[3];
+        for (int k = 0; k < 3; k++) {
+            e1[k] = _mm_loadu_ps(block._e1[k]);
+            e2[k] = _mm_loadu_ps(block._e2[k]);
+            s[k] = _mm_sub_ps(o[k], _mm_loadu_ps(block._v0[k]));
+        }
+        __m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])); // direction x e2
+        __m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2]));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], px), _mm_mul_ps(e1[1], py)), _mm_mul_ps(e1[2], pz));
+        __m128 valid = _mm_cmpgt_ps(_mm_max_ps(det, _mm_sub_ps(zero, det)), epsilon);
+        __m128 inv = _mm_div_ps(one, det);
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], px), _mm_mul_ps(s[1], py)), _mm_mul_ps(s[2], pz)), inv);
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])); // s x e1
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2]));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0]));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inv);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qx), _mm_mul_ps(e2[1], qy)), _mm_mul_ps(e2[2], qz)), inv);
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(best)));
+        int mask = _mm_movemask_ps(valid);
+        if (mask == 0) continue;
+        float ts[BVH_LEAF_SIZE], us[BVH_LEAF_SIZE], vs[BVH_LEAF_SIZE];
+        _mm_storeu_ps(ts, t);
+        _mm_storeu_ps(us, u);
+        _mm_storeu_ps(vs, v);
+        for (int j = 0; j < BVH_LEAF_SIZE; j++) {
+            if ((mask & (1 << j)) == 0 || ts[j] >= best) continue;
+            best = ts[j];
+            hit._face = block._face[j];
+            hit._t = ts[j];
+            hit._u = us[j];
+            hit._v = vs[j];
+        }
+    }
+    return hit._face != -1;
+}
+bool TriangleBVH::closestPoint(const vec3& p, SurfacePoint& closest, const float& maxDistance) const {
+    if (_nodes.empty() == true) return false;
+    float best2 = maxDistance < INFINITY ? maxDistance * maxDistance : INFINITY;
+    closest._face = -1;
+    int stack[2 * BVH_MAX_DEPTH];
+    int top = 0;
+    if (boxDistance2(_nodes[0], p) < best2) stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode& node = _nodes[stack[--top]];
+        if (boxDistance2(node, p) >= best2) continue;
+        if (node._count == 0) {
+            float a = boxDistance2(_nodes[node._first], p), b = boxDistance2(_nodes[node._first + 1], p);
+            if (a < b) { // the nearer child goes on top
+                if (b < best2) stack[top++] = node._first + 1;
+                stack[top++] = node._first;
+            }
+            else {
+                if (a < best2) stack[top++] = node._first;
+                if (b < best2) stack[top++] = node._first + 1;
+            }
+            continue;
+        }
+        const TriangleBlock& block = _blocks[node._first];
+        for (int j = 0; j < BVH_LEAF_SIZE; j++) {
+            if (block._face[j] == -1) continue;
+            vec3 a(block._v0[0][j], block._v0[1][j], block._v0[2][j]);
+            vec3 b = a + vec3(block._e1[0][j], block._e1[1][j], block._e1[2][j]);
+            vec3 c = a + vec3(block._e2[0][j], block._e2[1][j], block._e2[2][j]);
+            vec3 q = closestOnTriangle(p, a, b, c);
+            float d2 = dot(q - p, q - p);
+            if (d2 >= best2) continue;
+            best2 = d2;
+            closest._face = block._face[j];
+            closest._point = q;
+        }
+    }
+    if (closest._face == -1) return false;
+    closest._distance = sqrt(best2);
+    return true;
+}
+const TriangleBVH& MeshObject::bvh() {
+    int nFaces = _prefixFaces.size() > 0 && _viewDependent == false ? _prefixFaces[_collapseIndex()] : -1; // as visibleFaces
+    if (_bvh.nSlots() != (int)_triangleIndices.size() / 3) _bvh.build(_vertexPositions, _triangleIndices, nFaces);
+    else if (_bvhDirty == true) _bvh.refit(_vertexPositions, _triangleIndices, nFaces);
+    _bvhDirty = false;
+    return _bvh;
+}
+int MeshObject::pickVertex(const vec3& origin, const vec3& direction) {
+    RayHit hit;
+    if (_geomReady == false || bvh().intersect(origin, direction, hit) == false) return -1;
+    int corner = 0; // the corner with the largest barycentric weight
+    if (hit._u > 1 - hit._u - hit._v) corner = 1;
+    if (hit._v > fmax(hit._u, 1 - hit._u - hit._v)) corner = 2;
+    return _triangleIndices[3 * hit._face + corner];
+}
+
 float MeshObject::avgEdgeLength() { // approximate cause i don't feel like dealing with the double counting at the borders
     vector<int> f = visibleFaces();
     int n = f.size();
@@ -1187,81 +2288,383 @@ float MeshObject::avgEdgeLength() { // approximate cause i don't feel like deali
     return dAvg;
 }
 
-void MeshObject::quadricSimplify() {
-    if (_pairs.size() < 1) {
-        //printf("No more pairs to collapse.\n");
-        return;
+float MeshObject::nextCollapseError() {
+    while (_pairs.size() > 0) { // drop out-of-date pairs the same way quadricSimplify does
+        const Edge& e = _pairs.top();
+        if (_isCollapsible(e) == true) return e._qem;
+        _pairs.pop();
     }
-    Edge e = _pairs.top();
-    _pairs.pop();
-    //printf("%i %i %i %i\n", e._u0, e._u1, e._c0, e._c1);
-    while (e._c0 != _lastUpdate[e._u0] || e._c1 != _lastUpdate[e._u1]) {
-        if (_pairs.size() < 1) {
-            //printf("No more pairs to collapse.\n");
-            return;
-        }
-        e = _pairs.top();
+    return INFINITY;
+}
+bool MeshObject::quadricSimplify() {
+    while (_pairs.size() > 0) {
+        Edge e = _pairs.top();
         _pairs.pop();
-        //printf("  %i %i %i %i\n", e._u0, e._u1, e._c0, e._c1);
+        //printf("%i %i %i %i\n", e._u0, e._u1, e._c0, e._c1);
+        if (_isCollapsible(e) == false) continue;
+        int v0 = e._u0, v1 = e._u1;
+        int approximationMethod = e._qem < INFINITY ? QUADRIC_APPROXIMATION_METHOD : MIDPOINT_APPROXIMATION_METHOD;
+        if (_guardTopology == true) { // a pair passed over comes back once a neighbor collapse updates it
+            if (_keepsManifold(v0, v1) == false) continue;
+            if (_flipsFace(v0, v1, mergedCoordinates(v0, v1, approximationMethod)) == true) { // the optimum can slide off a boundary or fold a fan. try the midpoint and the ends
+                approximationMethod = MIDPOINT_APPROXIMATION_METHOD;
+                if (_flipsFace(v0, v1, mergedCoordinates(v0, v1, approximationMethod)) == true) approximationMethod = BINARY_APPROXIMATION_METHOD;
+                if (approximationMethod == BINARY_APPROXIMATION_METHOD && _flipsFace(v0, v1, _vertexPositions[v0]) == true) swap(v0, v1);
+                if (approximationMethod == BINARY_APPROXIMATION_METHOD && _flipsFace(v0, v1, _vertexPositions[v0]) == true) continue;
+            }
+        }
+        _collapseError = e._qem < INFINITY ? e._qem : -1;
+        collapse(v0, v1, approximationMethod);
+        _collapseError = -1; // random and midpoint collapses record none
+        return true;
+    }
+    //printf("No more pairs to collapse.\n");
+    return false;
+}
+bool MeshObject::simplifying() {
+    if (_worker != nullptr && _worker->running() == false) _worker->join();
+    return _worker != nullptr;
+}
+void MeshObject::snapshot(MeshSnapshot& out) {
+    out._positions = _vertexPositions; // assignment keeps the capacity from the last snapshot
+    out._normals = _vertexNormals;
+    out._colors = _vertexColors;
+    vector<int> visFaces = visibleFaces();
+    out._indices.resize(3 * visFaces.size());
+    for (int i = 0; i < (int)visFaces.size(); i++) {
+        for (int j = 0; j < 3; j++) out._indices[3 * i + j] = _triangleIndices[3 * visFaces[i] + j];
     }
-    if (e._qem < INFINITY) collapse(e._u0, e._u1, QUADRIC_APPROXIMATION_METHOD);
-    else collapse(e._u0, e._u1, MIDPOINT_APPROXIMATION_METHOD);
+    out._nCollapses = _nCollapses;
+}
+
+bool SimplifyWorker::start(MeshObject* mesh, const int& nCollapses, function<void(MeshObject*)> finish) {
+    if (_running == true || mesh->simplifying() == true) return false;
+    join(); // a finished run on another mesh
+    _mesh = mesh;
+    _finish = finish;
+    _target = nCollapses;
+    _nDone = 0;
+    _cancel = false;
+    _fresh = false;
+    _running = true;
+    mesh->_worker = this;
+    _thread = thread(&SimplifyWorker::_run, this);
+    return true;
+}
+void SimplifyWorker::join() {
+    if (_thread.joinable()) _thread.join();
+    if (_mesh != nullptr && _mesh->_worker == this) _mesh->_worker = nullptr;
+    _mesh = nullptr;
+}
+bool SimplifyWorker::swap() {
+    lock_guard<mutex> lock(_swapMutex);
+    if (_fresh == false) return false;
+    std::swap(_front, _ready);
+    _fresh = false;
+    return true;
+}
+void SimplifyWorker::_publish() {
+    _mesh->snapshot(_snapshots[_back]);
+    lock_guard<mutex> lock(_swapMutex);
+    std::swap(_back, _ready);
+    _fresh = true;
+}
+void SimplifyWorker::_run() {
+    _publish(); // so the first frame has something to draw
+    auto lastPublish = chrono::steady_clock::now();
+    while (_nDone < _target && _cancel == false) {
+        if (_mesh->quadricSimplify() == false) break;
+        _nDone++;
+        auto now = chrono::steady_clock::now();
+        if (now - lastPublish >= chrono::milliseconds(_publishSpacing)) {
+            _publish();
+            lastPublish = now;
+            printf("Pairs Collapsed: %i of %i\r", (int)_nDone, _target);
+        }
+    }
+    if (_target > 0) printf("Pairs Collapsed: %i of %i%s\n", (int)_nDone, _target, _cancel == true ? ", cancelled" : "");
+    if (_cancel == false && _finish != nullptr) _finish(_mesh);
+    _publish();
+    _running = false;
 }
 
 void MeshObject::doDraw()
 {
+    if (simplifying() == true) { // draw whatever the worker published last
+        _uploadedBytes = 0;
+        if (_worker->swap() == true) _uploadSnapshot(_worker->front());
+        _uploadedBytesTotal += _uploadedBytes;
+        if (_vertexArrayID != 0) _drawBuffers(_snapshotIndexCount, 0);
+        glutPostRedisplay(); // keep the frames coming until the worker is done
+        return;
+    }
     if (!_geomReady) readGeom();
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_NORMAL_ARRAY);
-    if (_customColors==true) glEnableClientState(GL_COLOR_ARRAY);
-    else glDisableClientState(GL_COLOR_ARRAY);
-    glEnableClientState(GL_COLOR_ARRAY);
-
-    /*pair<vector<vec3>, vector<vec4>> asdf = vRedundant();
-    vector<vec3> v = asdf.first;
-    vector<vec4> c = asdf.second;
-    glVertexPointer(3, GL_FLOAT,0, &v[0]);
-    glColorPointer(4, GL_FLOAT, 0, &c[0]);
-    glDrawArrays(GL_TRIANGLES, 0, v.size());
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//*/
-
-
-    glVertexPointer(3, GL_FLOAT, 0, &_vertexPositions[0]);
-    glNormalPointer(GL_FLOAT, 0, &_vertexNormals[0]);
-    glColorPointer(4, GL_FLOAT, 0, &_vertexColors[0]);
-    GLuint IBO;
-    glGenBuffers(1, &IBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*_triangleIndices.size(), &_triangleIndices[0], GL_STATIC_DRAW);
-    glDrawElements(GL_TRIANGLES, _triangleIndices.size(), GL_UNSIGNED_INT, 0);
+    if (_autoLOD == true && _viewDependent == false) {
+        mat4 modelView, projection;
+        GLint vp[4];
+        glGetFloatv(GL_MODELVIEW_MATRIX, &modelView[0][0]);
+        glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+        glGetIntegerv(GL_VIEWPORT, vp);
+        float complexity = selectComplexity(modelView, projection, vec4(vp[0], vp[1], vp[2], vp[3]));
+        if (complexity != targetComplexity()) setTargetComplexity(complexity);
+    }
+    if (_lodTarget >= 0) {
+        _updateLOD();
+        glutPostRedisplay(); // the transition needs more frames
+    }
+    if (_viewDependent == true) {
+        mat4 modelView, projection;
+        vec4 viewport;
+        GLint vp[4];
+        glGetFloatv(GL_MODELVIEW_MATRIX, &modelView[0][0]);
+        glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+        glGetIntegerv(GL_VIEWPORT, vp);
+        viewport = vec4(vp[0], vp[1], vp[2], vp[3]);
+        refineView(modelView, projection, viewport);
+    }
+    _uploadedBytes = 0;
+    if (_buffersReady == false) _createBuffers();
+    _uploadBuffers();
+    _uploadedBytesTotal += _uploadedBytes;
+    if (_prefixFaces.size() > 0 && _viewDependent == false) { // the current LOD is a prefix of the faces and vertices
+        int collapseIndex = _collapseIndex();
+        _drawBuffers(3 * _prefixFaces[collapseIndex], _prefixVertices[collapseIndex]);
+    }
+    else _drawBuffers(_triangleIndices.size(), 0);
+    if (_drawVertexNormals == true && _format == "off") _drawNormals();
+    return;
+}
+void MeshObject::_drawBuffers(const int& nIndices, const int& nVertices) {
+    glPushMatrix();
+    glTranslatef(_quantizationCenter[0], _quantizationCenter[1], _quantizationCenter[2]); // positions are stored in quantization steps
+    glScalef(_quantizationStep, _quantizationStep, _quantizationStep);
+    glEnable(GL_RESCALE_NORMAL);
+    bindVertexArray(_vertexArrayID); // already bound when the queue draws, unless an upload had to unbind it
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _triangleBufferID);
+    if (nVertices > 0) glDrawRangeElements(GL_TRIANGLES, 0, nVertices - 1, nIndices, _indexType(), 0);
+    else glDrawElements(GL_TRIANGLES, nIndices, _indexType(), 0);
     if (_drawMode == 0) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    if (_drawVertexNormals == false) return;
-    ////////////////////////
-    ///// DRAW NORMALS /////
-    ////////////////////////
-    glGenBuffers(1, &IBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*_lineIndices.size(), &_lineIndices[0], GL_STATIC_DRAW);
-
-    glDrawElements(GL_LINES, _lineIndices.size(), GL_UNSIGNED_INT, 0);//*/
-
-    return;
+    glDisable(GL_RESCALE_NORMAL);
+    glPopMatrix();
+}
+void MeshObject::_uploadSnapshot(const MeshSnapshot& snapshot) {
+    int nV = snapshot._positions.size();
+    if (_vertexArrayID == 0) _allocateBuffers(nV, snapshot._indices.size());
+    _buffersReady = false; // the live arrays go back up in full once the worker is done
+    _fitQuantization(snapshot._positions, 0);
+    vector<i16vec4> positions(nV);
+    vector<i8vec4> normals(nV);
+    vector<u8vec4> colors(nV);
+    for (int v = 0; v < nV; v++) {
+        positions[v] = quantizePosition(snapshot._positions[v], _quantizationCenter, _quantizationStep);
+        normals[v] = packNormal(snapshot._normals[v]);
+        colors[v] = packColor(snapshot._colors[v]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, _positionBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(i16vec4)*nV, positions.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(i8vec4)*nV, normals.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, _colorBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(u8vec4)*nV, colors.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    _shortIndices = nV <= 65536;
+    bindElementBuffer(_triangleBufferID);
+    if (_shortIndices == true) {
+        vector<unsigned short> packed(snapshot._indices.begin(), snapshot._indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*packed.size(), packed.data(), GL_DYNAMIC_DRAW);
+    }
+    else glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*snapshot._indices.size(), snapshot._indices.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    _snapshotIndexCount = snapshot._indices.size();
+    _uploadedBytes += (sizeof(i16vec4) + sizeof(i8vec4) + sizeof(u8vec4))*nV + _indexSize()*_snapshotIndexCount;
+}
+void MeshObject::_drawNormals() {
+    if (_adjacency.size() < 4) return; // what is left by then has no meaningful normals
+    for (map<int, set<int>>::const_iterator i = _adjacency.begin(); i != _adjacency.end(); i++) {
+        if (i->second.size() == 0) continue;
+        float nScale = 0;
+        for (set<int>::const_iterator f = i->second.begin(); f != i->second.end(); f++) nScale += _faceAreas[*f];
+        nScale = sqrt(nScale / (float)i->second.size());
+        const vec3& p = _vertexPositions[i->first];
+        _drawLine(p, p + nScale*_vertexNormals[i->first], _vertexColors[i->first]);
+    }
+}
+void MeshObject::_createBuffers() { // allocate the GPU copies once. after this only the dirty ranges are uploaded
+    _fitQuantization();
+    _allocateBuffers(_vertexPositions.size(), _triangleIndices.size());
+    // the contents go up packed with the first _uploadBuffers
+    _dirtyPositions.clear();
+    _dirtyPositions.add(0, _vertexPositions.size());
+    _dirtyNormals.clear();
+    _dirtyNormals.add(0, _vertexNormals.size());
+    _dirtyColors.clear();
+    _dirtyColors.add(0, _vertexColors.size());
+    _dirtyTriangles.clear();
+    _dirtyTriangles.add(0, _triangleIndices.size());
+    _buffersReady = true;
+}
+void MeshObject::_allocateBuffers(const int& nVertices, const int& nIndices) {
+    _deleteBuffers();
+    _shortIndices = nVertices <= 65536;
+    glGenVertexArrays(1, &_vertexArrayID);
+    bindVertexArray(_vertexArrayID);
+    glGenBuffers(1, &_positionBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _positionBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(i16vec4)*nVertices, NULL, GL_DYNAMIC_DRAW);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_SHORT, sizeof(i16vec4), 0);
+    glGenBuffers(1, &_normalBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(i8vec4)*nVertices, NULL, GL_DYNAMIC_DRAW);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_BYTE, sizeof(i8vec4), 0); // byte normals are normalized by GL
+    glGenBuffers(1, &_colorBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _colorBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(u8vec4)*nVertices, NULL, GL_DYNAMIC_DRAW);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
+    glGenBuffers(1, &_triangleBufferID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _triangleBufferID);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indexSize()*nIndices, NULL, GL_DYNAMIC_DRAW);
+    bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void MeshObject::_deleteBuffers() {
+    if (_vertexArrayID == 0) return; // never drawn, so there is nothing to delete (and maybe no GL context on this thread)
+    GLuint buffers[4] = { _positionBufferID, _normalBufferID, _colorBufferID, _triangleBufferID };
+    bindVertexArray(0);
+    if (_vertexArrayID != 0) glDeleteVertexArrays(1, &_vertexArrayID);
+    glDeleteBuffers(4, buffers); // zeros are ignored
+    _vertexArrayID = 0;
+    _positionBufferID = 0;
+    _normalBufferID = 0;
+    _colorBufferID = 0;
+    _triangleBufferID = 0;
+    _buffersReady = false;
+}
+template <typename T> static size_t uploadSpans(const GLenum& target, const vector<pair<int, int>>& spans, const vector<T>& packed) { // packed holds the spans back to back
+    int offset = 0;
+    for (int i = 0; i < (int)spans.size(); i++) {
+        int n = spans[i].second - spans[i].first;
+        glBufferSubData(target, sizeof(T)*spans[i].first, sizeof(T)*n, &packed[offset]);
+        offset += n;
+    }
+    return sizeof(T)*offset;
+}
+static size_t uploadIndexSpans(DirtyRanges& dirty, const vector<int>& indices, const bool& shortIndices) { // into the bound element buffer
+    const vector<pair<int, int>>& spans = dirty.spans();
+    size_t nBytes = 0;
+    if (shortIndices == true) {
+        vector<unsigned short> packed;
+        packed.reserve(dirty.nElements());
+        for (int i = 0; i < (int)spans.size(); i++) packed.insert(packed.end(), indices.begin() + spans[i].first, indices.begin() + spans[i].second);
+        nBytes = uploadSpans(GL_ELEMENT_ARRAY_BUFFER, spans, packed);
+    }
+    else {
+        for (int i = 0; i < (int)spans.size(); i++) {
+            int n = spans[i].second - spans[i].first;
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*spans[i].first, sizeof(int)*n, &indices[spans[i].first]);
+            nBytes += sizeof(int)*n;
+        }
+    }
+    dirty.clear();
+    return nBytes;
+}
+void MeshObject::_uploadBuffers() {
+    if (_dirtyPositions.empty() == false) {
+        vector<i16vec4> packed;
+        const vector<pair<int, int>>& spans = _dirtyPositions.spans();
+        bool fits = true;
+        for (int i = 0; i < (int)spans.size() && fits == true; i++) fits = _packPositions(spans[i].first, spans[i].second, packed);
+        if (fits == false) { // simplification moved a vertex out of the cube. refit and send everything
+            _fitQuantization();
+            _dirtyPositions.clear();
+            _dirtyPositions.add(0, _vertexPositions.size());
+            packed.clear();
+            _packPositions(0, _vertexPositions.size(), packed);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, _positionBufferID);
+        _uploadedBytes += uploadSpans(GL_ARRAY_BUFFER, _dirtyPositions.spans(), packed);
+        _dirtyPositions.clear();
+    }
+    if (_dirtyNormals.empty() == false) {
+        const vector<pair<int, int>>& spans = _dirtyNormals.spans();
+        vector<i8vec4> packed;
+        packed.reserve(_dirtyNormals.nElements());
+        for (int i = 0; i < (int)spans.size(); i++) {
+            for (int v = spans[i].first; v < spans[i].second; v++) packed.push_back(packNormal(_vertexNormals[v]));
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+        _uploadedBytes += uploadSpans(GL_ARRAY_BUFFER, spans, packed);
+        _dirtyNormals.clear();
+    }
+    if (_dirtyColors.empty() == false) {
+        const vector<pair<int, int>>& spans = _dirtyColors.spans();
+        vector<u8vec4> packed;
+        packed.reserve(_dirtyColors.nElements());
+        for (int i = 0; i < (int)spans.size(); i++) {
+            for (int v = spans[i].first; v < spans[i].second; v++) packed.push_back(packColor(_vertexColors[v]));
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, _colorBufferID);
+        _uploadedBytes += uploadSpans(GL_ARRAY_BUFFER, spans, packed);
+        _dirtyColors.clear();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    _uploadIndices(_triangleBufferID, _triangleIndices, _dirtyTriangles);
+}
+void MeshObject::_uploadIndices(const GLuint& bufferID, const vector<int>& indices, DirtyRanges& dirty) {
+    if (dirty.empty() == true) return;
+    bindElementBuffer(bufferID);
+    _uploadedBytes += uploadIndexSpans(dirty, indices, _shortIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+void MeshObject::_fitQuantization(const vector<vec3>& positions, const int& nCollapses) {
+    vec3 lo(INFINITY, INFINITY, INFINITY), hi(-INFINITY, -INFINITY, -INFINITY);
+    for (int v = 0; v < (int)positions.size(); v++) {
+        if (any(isnan(positions[v])) == true) continue; // glm's min/max would let a NaN reset the bounds
+        lo = min(lo, positions[v]);
+        hi = max(hi, positions[v]);
+    }
+    for (int i = 0; i < nCollapses; i++) { // progressive meshes also visit the collapse positions, and geomorphs stay between them
+        lo = min(lo, _collapses[i]._xyz);
+        hi = max(hi, _collapses[i]._xyz);
+    }
+    if (lo[0] > hi[0]) lo = hi = vec3(0, 0, 0);
+    vec3 extent = hi - lo;
+    _quantizationCenter = 0.5f * (lo + hi);
+    _quantizationStep = fmax(fmax(extent[0], fmax(extent[1], extent[2])) / 65534.0f, 1e-20); // one step for all axes keeps the scale uniform for the normals
+    _quantizationError = 0;
+}
+bool MeshObject::_packPositions(const int& begin, const int& end, vector<i16vec4>& packed) {
+    float tolerance = _quantizationStep; // rounding alone is at most sqrt(3)/2 steps off, anything more was clamped
+    for (int v = begin; v < end; v++) {
+        i16vec4 q = quantizePosition(_vertexPositions[v], _quantizationCenter, _quantizationStep);
+        float error = length(dequantizePosition(q, _quantizationCenter, _quantizationStep) - _vertexPositions[v]);
+        if (error > tolerance) return false;
+        _quantizationError = fmax(_quantizationError, error);
+        packed.push_back(q);
+    }
+    return true;
 }
 
 
 
 
 void MeshObject::collapseTo(const float& newComplexity) {
-    float fOldCollapseIndex = (float)(nVerticesCollapsed() + _v0.size()) - _complexity; // this corresponds to the current mesh "adjacency" (BEFORE carrying out collapse[index])
-    float fNewCollapseIndex = (float)(nVerticesCollapsed() + _v0.size()) - newComplexity; // these are both the index OF THE COLLAPSE
+    if (_viewDependent == true) return; // refineView owns the index buffer
+    _finishTransition();
+    _lodTarget = -1;
+    if (_checkpoints.size() > 0) _seekCheckpoint(newComplexity);
+    float fOldCollapseIndex = (float)(nVerticesCollapsed() + _collapses.size()) - _complexity; // this corresponds to the current mesh "adjacency" (BEFORE carrying out collapse[index])
+    float fNewCollapseIndex = (float)(nVerticesCollapsed() + _collapses.size()) - newComplexity; // these are both the index OF THE COLLAPSE
     //float fOldCollapseIndex = (float)_nV - _complexity;
     //float fNewCollapseIndex = (float)_nV - newComplexity;
     //float fOldCollapseIndex = (float)_vertexPositions.size() - _complexity;
     //float fNewCollapseIndex = (float)_vertexPositions.size() - newComplexity;
-    fOldCollapseIndex = fmin(fmax(0, fOldCollapseIndex), _v0.size());
-    fNewCollapseIndex = fmin(fmax(0, fNewCollapseIndex), _v0.size());
+    fOldCollapseIndex = fmin(fmax(0, fOldCollapseIndex), _collapses.size());
+    fNewCollapseIndex = fmin(fmax(0, fNewCollapseIndex), _collapses.size());
     int oldCollapseIndex = fOldCollapseIndex;
     int newCollapseIndex = fNewCollapseIndex;
     float alpha = fNewCollapseIndex - newCollapseIndex;
@@ -1272,50 +2675,609 @@ void MeshObject::collapseTo(const float& newComplexity) {
         return;
     }
     else if (_complexity > newComplexity) { // COLLAPSE
-        for (int i = oldCollapseIndex; i < newCollapseIndex; i++) { // for each "full" collapse to get to newPos
-            _vertexPositions[_v0[i]] = _xyz[i]; // update the coordinates of v=v0
-            _vertexNormals[_v0[i]] = _n[i];
-            for (int j = 0; j < _fVec[i].size(); j++) { // for each face in the updated adjacency for v=v0
-                int f = _fVec[i][j];
-                for (int k = 0; k < 3; k++) {
-                    if (_faces[f][k] == _v1[i]) _faces[f][k] = _v0[i];
-                    if (_triangleIndices[3 * f + k] == _v1[i]) _triangleIndices[3 * f + k] = _v0[i]; // change all corners from v1 to v=v0
-                }
-            }
-            for (int j = 0; j < _fVecR[i].size(); j++) { // for each face that is shared between v0,v1
-                int f = _fVecR[i][j];
-                for (int k = 0; k < 3; k++) _triangleIndices[3 * f + k] = 0; // obliterate it from existence
-            }
-        }
+        for (int i = oldCollapseIndex; i < newCollapseIndex; i++) _applyCollapse(i); // for each "full" collapse to get to newPos
     }
     else if (_complexity < newComplexity) { // SPLIT
         for (int i = oldCollapseIndex; i > newCollapseIndex-1; i--) {
-            if (i == _v0.size()) continue;
-            _vertexPositions[_v0[i]] = _xyz0[i];
-            _vertexPositions[_v1[i]] = _xyz1[i];
-            _vertexNormals[_v0[i]] = _n0[i];
-            _vertexNormals[_v1[i]] = _n1[i];
-            for (int j = 0; j < _fVecR[i].size(); j++) {
-                int f = _fVecR[i][j];
-                _faces[f] = _fVecRijk[i][j];
-                for (int k = 0; k < 3; k++) _triangleIndices[3 * f + k] = _faces[f][k];
-            }
-            for (int j = 0; j < _fVec1[i].size(); j++) {
-                int f = _fVec1[i][j];
-                for (int k = 0; k < 3; k++) {
-                    if (_faces[f][k] == _v0[i]) _faces[f][k] = _v1[i];
-                    _triangleIndices[3 * f + k] = _faces[f][k];
+            if (i == (int)_collapses.size()) continue;
+            _applySplit(i);
+        }
+    }
+    _complexity = fmin(fmax(_vertexPositions.size() - _collapses.size(), newComplexity), _vertexPositions.size()); // update the current _complexity
+    // GEOMORPH: small alpha means we are close to the full split
+    if (newCollapseIndex >= (int)_collapses.size()) return;
+    const Collapse& c = _collapses[newCollapseIndex];
+    _vertexPositions[c._v0] = (1.0f - alpha)*c._xyz0 + alpha*c._xyz;
+    _vertexPositions[c._v1] = (1.0f - alpha)*c._xyz1 + alpha*c._xyz;
+    _markVertexDirty(c._v0);
+    _markVertexDirty(c._v1);
+    if (_recomputeCollapseNormals == false) {
+        _vertexNormals[c._v0] = (1.0f - alpha)*_collapseNormals[3 * newCollapseIndex + 0] + alpha*_collapseNormals[3 * newCollapseIndex + 2];
+        _vertexNormals[c._v1] = (1.0f - alpha)*_collapseNormals[3 * newCollapseIndex + 1] + alpha*_collapseNormals[3 * newCollapseIndex + 2];
+    }
+    else {
+        vec3 n0 = _faceNormalSum(c._v0, _fVec(c), c._nF) + _faceNormalSum(c._v0, _fVecR(c), c._nFR);
+        vec3 n1 = _faceNormalSum(c._v1, _fVec1(c), c._nF1) + _faceNormalSum(c._v1, _fVecR(c), c._nFR);
+        if (length(n0) > 0) _vertexNormals[c._v0] = normalize(n0);
+        if (length(n1) > 0) _vertexNormals[c._v1] = normalize(n1);
+    }
+}
+void MeshObject::setTargetComplexity(const float& target) {
+    if (_format != "offpm" || _viewDependent == true) return;
+    _lodTarget = fmin(fmax(0, target), nVertices());
+}
+void MeshObject::_updateLOD() {
+    typedef chrono::high_resolution_clock Clock;
+    Clock::time_point deadline = Clock::now() + chrono::microseconds((long long)_lodBudget);
+    if (_lodPhase == LOD_IDLE) {
+        if (_targetCollapseIndex() == _collapseIndex()) {
+            _lodTarget = -1;
+            return;
+        }
+        _openWindow();
+    }
+    bool collapsing = _windowTo > _windowFrom;
+    if (_lodPhase == LOD_APPLYING) {
+        _applyFrames++;
+        if (_applyWindow(deadline) == false) return;
+        if (_applyFrames <= 1) _windowSize = fmin(2 * _windowSize, fmax(_collapses.size(), 1)); // it fit in one frame, try more next time
+        else if (_applyFrames > _morphFrames) _windowSize = fmax(_windowSize / 2, 16);
+        if (collapsing == true) _lodPhase = LOD_IDLE;
+        else {
+            _lodPhase = LOD_MORPHING;
+            _lodFrame = 0;
+        }
+        return;
+    }
+    _lodFrame++;
+    float t = fmin(1, _lodFrame / (float)_morphFrames);
+    _morph(collapsing == true ? t : 1 - t);
+    if (t < 1) return;
+    if (collapsing == true) {
+        _lodPhase = LOD_APPLYING;
+        _applyFrames = 0;
+    }
+    else _lodPhase = LOD_IDLE;
+}
+void MeshObject::_openWindow() {
+    int from = _collapseIndex();
+    int to = _targetCollapseIndex();
+    _windowFrom = from;
+    _windowTo = to > from ? fmin(to, from + _windowSize) : fmax(to, from - _windowSize);
+    int lo = fmin(_windowFrom, _windowTo), hi = fmax(_windowFrom, _windowTo); // collapses [lo, hi) change
+    _morphVertices.clear();
+    _morphFine.clear();
+    if (_morphSlot.size() != _vertexPositions.size()) _morphSlot.assign(_vertexPositions.size(), -1);
+    for (int j = lo; j < hi; j++) {
+        int v[2] = { _collapses[j]._v0, _collapses[j]._v1 };
+        for (int k = 0; k < 2; k++) {
+            if (_morphSlot[v[k]] != -1) continue;
+            _morphSlot[v[k]] = _morphVertices.size();
+            _morphVertices.push_back(v[k]);
+            _morphFine.push_back(_vertexPositions[v[k]]);
+        }
+    }
+    _morphCoarse = _morphFine; // the current positions, which are the fine ones when collapsing and the coarse ones when splitting
+    if (_windowTo > _windowFrom) {
+        for (int j = lo; j < hi; j++) _morphCoarse[_morphSlot[_collapses[j]._v0]] = _collapses[j]._xyz;
+    }
+    else {
+        for (int j = hi - 1; j >= lo; j--) { // the earliest collapse of a vertex knows where it was before the window
+            _morphFine[_morphSlot[_collapses[j]._v0]] = _collapses[j]._xyz0;
+            _morphFine[_morphSlot[_collapses[j]._v1]] = _collapses[j]._xyz1;
+        }
+    }
+    for (int j = hi - 1; j >= lo; j--) { // a removed vertex ends where the vertex it merged into ends, which is settled by then
+        _morphCoarse[_morphSlot[_collapses[j]._v1]] = _morphCoarse[_morphSlot[_collapses[j]._v0]];
+    }
+    for (int i = 0; i < (int)_morphVertices.size(); i++) _morphSlot[_morphVertices[i]] = -1;
+    if (_windowTo > _windowFrom) {
+        _lodPhase = LOD_MORPHING;
+        _lodFrame = 0;
+    }
+    else {
+        _lodPhase = LOD_APPLYING; // split first, invisibly, with everything still at the coarse positions
+        _applyFrames = 0;
+    }
+    _windowNext = _windowTo > _windowFrom ? _windowFrom : _windowFrom - 1;
+}
+bool MeshObject::_applyWindow(const chrono::high_resolution_clock::time_point& deadline) {
+    bool done = false;
+    for (int n = 1; done == false; n++) {
+        if (_windowTo > _windowFrom) {
+            if (_windowNext < _windowTo) _applyCollapse(_windowNext++);
+            done = _windowNext >= _windowTo;
+        }
+        else {
+            if (_windowNext >= _windowTo) _applySplit(_windowNext--);
+            done = _windowNext < _windowTo;
+        }
+        if (n % 16 == 0 && chrono::high_resolution_clock::now() > deadline) break;
+    }
+    int applied = _windowTo > _windowFrom ? _windowNext : _windowNext + 1; // collapses [0, applied) are in the index buffer
+    _complexity = nVerticesCollapsed() + _collapses.size() - applied;
+    _morph(1); // applying moved window vertices back to where the records say
+    return done;
+}
+void MeshObject::_morph(const float& alpha) {
+    int n = _morphVertices.size();
+    if (n == 0) return;
+    _morphOut.resize(n);
+    const float* fine = &_morphFine[0][0];
+    const float* coarse = &_morphCoarse[0][0];
+    float* out = &_morphOut[0][0];
+    for (int k = 0; k < 3 * n; k++) out[k] = fine[k] + alpha*(coarse[k] - fine[k]); // flat float arrays, so this loop vectorizes
+    for (int i = 0; i < n; i++) {
+        _vertexPositions[_morphVertices[i]] = _morphOut[i];
+        _dirtyPositions.add(_morphVertices[i]); // their normals stay put until the window is applied
+    }
+    _bvhDirty = true;
+}
+void MeshObject::_finishTransition() {
+    if (_lodPhase == LOD_IDLE) return;
+    bool collapsing = _windowTo > _windowFrom;
+    _applyWindow(chrono::high_resolution_clock::time_point::max());
+    _morph(collapsing == true ? 1 : 0);
+    _lodPhase = LOD_IDLE;
+}
+void MeshObject::_buildErrorCurve() {
+    vector<float> vertexError(_vertexPositions.size(), 0); // how far the surface around each vertex has strayed so far
+    _errorCurve.resize(_collapses.size() + 1);
+    _errorCurve[0] = 0;
+    for (int i = 0; i < (int)_collapses.size(); i++) {
+        const Collapse& c = _collapses[i];
+        float error = sqrt(fmax(c._error, 0));
+        if (c._error < 0) error = fmax(distance(c._xyz0, c._xyz), distance(c._xyz1, c._xyz)); // no error on file. how far the pair moves instead
+        error += fmax(vertexError[c._v0], vertexError[c._v1]); // the quadrics only see the current faces, so add up what the merged vertices carried
+        vertexError[c._v0] = error;
+        _errorCurve[i + 1] = fmax(_errorCurve[i], error);
+    }
+    _errorHull.clear(); // lower convex hull of (triangles, error), walking from the full mesh towards the base one
+    for (int i = 0; i < (int)_errorCurve.size(); i++) {
+        while (_errorHull.size() >= 2) {
+            int a = _errorHull[_errorHull.size() - 2], b = _errorHull.back();
+            float cross = (float)(_prefixFaces[a] - _prefixFaces[b]) * (_errorCurve[i] - _errorCurve[a]) - (float)(_prefixFaces[a] - _prefixFaces[i]) * (_errorCurve[b] - _errorCurve[a]);
+            if (cross > 0) break; // b lies below the line from a to i
+            _errorHull.pop_back();
+        }
+        _errorHull.push_back(i);
+    }
+}
+float MeshObject::selectComplexity(const mat4& modelView, const mat4& projection, const vec4& viewport) {
+    if (_errorCurve.size() < 2) return _complexity;
+    vec3 center(0.5f*(_xMin + _xMax), 0.5f*(_yMin + _yMax), 0.5f*(_zMin + _zMax));
+    float radius = 0.5f*length(vec3(_xMax - _xMin, _yMax - _yMin, _zMax - _zMin));
+    float z = -(modelView * vec4(center, 1))[2]; // Panel::draw puts the camera Camera::getTz away
+    float kappa = pixelsPerUnit(projection, viewport[3]);
+    int index = 0; // collapses to apply
+    if (z > radius) { // otherwise the camera is inside the bounds, so keep everything
+        index = collapseIndexForError(_errorCurve, _pixelTolerance * (z - radius) / kappa); // the largest error that stays within the tolerance on screen
+    }
+    return nVerticesCollapsed() + _collapses.size() - index;
+}
+void MeshObject::_applyCollapse(const int& i) {
+    const Collapse& c = _collapses[i];
+    const int* fVec = _fVec(c);
+    const int* fVecR = _fVecR(c);
+    _vertexPositions[c._v0] = c._xyz; // update the coordinates of v=v0
+    _markVertexDirty(c._v0);
+    for (int j = 0; j < c._nF; j++) { // for each face in the updated adjacency for v=v0
+        int f = fVec[j];
+        for (int k = 0; k < 3; k++) {
+            if (_faces[f][k] == c._v1) _faces[f][k] = c._v0;
+            if (_triangleIndices[3 * f + k] != c._v1) continue;
+            _triangleIndices[3 * f + k] = c._v0; // change all corners from v1 to v=v0
+            _markFaceDirty(f);
+        }
+    }
+    for (int j = 0; j < c._nFR; j++) { // for each face that is shared between v0,v1
+        if (_viewDependent == false) break; // they are past the end of the drawn prefix now
+        int f = fVecR[j];
+        for (int k = 0; k < 3; k++) _triangleIndices[3 * f + k] = 0; // obliterate it from existence
+        _markFaceDirty(f);
+    }
+    if (_recomputeCollapseNormals == false) _vertexNormals[c._v0] = _collapseNormals[3 * i + 2];
+    else {
+        vec3 n = _faceNormalSum(c._v0, fVec, c._nF);
+        if (length(n) > 0) _vertexNormals[c._v0] = normalize(n);
+    }
+}
+void MeshObject::_applySplit(const int& i) {
+    const Collapse& c = _collapses[i];
+    const int* fVec1 = _fVec1(c);
+    const int* fVecR = _fVecR(c);
+    const int* fVecRijk = _fVecRijk(c);
+    _vertexPositions[c._v0] = c._xyz0;
+    _vertexPositions[c._v1] = c._xyz1;
+    _markVertexDirty(c._v0);
+    _markVertexDirty(c._v1);
+    for (int j = 0; j < c._nFR; j++) {
+        int f = fVecR[j];
+        for (int k = 0; k < 3; k++) {
+            _faces[f][k] = fVecRijk[3 * j + k];
+            if (_triangleIndices[3 * f + k] == _faces[f][k]) continue; // faces removed in prefix order keep their corners
+            _triangleIndices[3 * f + k] = _faces[f][k];
+            _markFaceDirty(f);
+        }
+    }
+    for (int j = 0; j < c._nF1; j++) {
+        int f = fVec1[j];
+        for (int k = 0; k < 3; k++) {
+            if (_faces[f][k] == c._v0) _faces[f][k] = c._v1;
+            if (_triangleIndices[3 * f + k] == _faces[f][k]) continue;
+            _triangleIndices[3 * f + k] = _faces[f][k];
+            _markFaceDirty(f);
+        }
+    }
+    if (_recomputeCollapseNormals == false) {
+        _vertexNormals[c._v0] = _collapseNormals[3 * i + 0];
+        _vertexNormals[c._v1] = _collapseNormals[3 * i + 1];
+    }
+    else {
+        vec3 n0 = _faceNormalSum(c._v0, _fVec(c), c._nF) + _faceNormalSum(c._v0, fVecR, c._nFR);
+        vec3 n1 = _faceNormalSum(c._v1, fVec1, c._nF1) + _faceNormalSum(c._v1, fVecR, c._nFR);
+        if (length(n0) > 0) _vertexNormals[c._v0] = normalize(n0);
+        if (length(n1) > 0) _vertexNormals[c._v1] = normalize(n1);
+    }
+}
+void MeshObject::setViewDependent(const bool& viewDependent) {
+    if (viewDependent == _viewDependent) return;
+    if (_format != "offpm") {
+        printf("View-dependent refinement needs a progressive mesh\n");
+        return;
+    }
+    _finishTransition();
+    _lodTarget = -1;
+    if (viewDependent == false) { // back to a prefix of collapses for collapseTo. applying the rest in order is always legal
+        for (int i = 0; i < (int)_collapses.size(); i++) {
+            if (_applied[i] == false) _applyCollapse(i);
+        }
+        _complexity = nVerticesCollapsed();
+        _viewDependent = false;
+        printf("View-dependent refinement off\n");
+        return;
+    }
+    if (_nodes.size() != _collapses.size()) _buildHierarchy();
+    float complexity = floor(_complexity + 0.5f);
+    if (complexity != _complexity) collapseTo(complexity); // drop the geomorph
+    int collapseIndex = _collapseIndex();
+    for (int f = _prefixFaces[collapseIndex]; f < (int)_faces.size(); f++) { // refineView removes faces anywhere in the buffer, so they must be degenerate
+        for (int k = 0; k < 3; k++) _triangleIndices[3 * f + k] = 0;
+    }
+    _dirtyTriangles.add(3 * _prefixFaces[collapseIndex], _triangleIndices.size());
+    _bvhDirty = true;
+    _applied.assign(_collapses.size(), false);
+    for (int i = 0; i < collapseIndex; i++) _applied[i] = true;
+    _faceRecordCursor.resize(_faces.size());
+    for (int f = 0; f < (int)_faces.size(); f++) {
+        const int* first = _faceRecords.data() + _faceRecordsOffset[f];
+        const int* last = _faceRecords.data() + _faceRecordsOffset[f + 1];
+        _faceRecordCursor[f] = lower_bound(first, last, collapseIndex) - first;
+    }
+    _front.clear();
+    _onFront.assign(_collapses.size(), false);
+    for (int i = 0; i < (int)_collapses.size(); i++) {
+        if (_isActiveNode(i) || _canCollapse(i)) _touchFront(i);
+    }
+    _viewDependent = true;
+    printf("View-dependent refinement on\n");
+}
+void MeshObject::_buildHierarchy() { // face dependencies, parent links and bounds for every collapse record
+    int nC = _collapses.size();
+    _faceRecordsOffset.assign(_faces.size() + 1, 0);
+    for (int i = 0; i < nC; i++) {
+        const Collapse& c = _collapses[i];
+        for (int j = 0; j < c._nF; j++) _faceRecordsOffset[_fVec(c)[j] + 1]++;
+        for (int j = 0; j < c._nFR; j++) _faceRecordsOffset[_fVecR(c)[j] + 1]++;
+    }
+    for (int f = 0; f < (int)_faces.size(); f++) _faceRecordsOffset[f + 1] += _faceRecordsOffset[f];
+    _faceRecords.resize(_faceRecordsOffset.back());
+    vector<int> fill(_faceRecordsOffset.begin(), _faceRecordsOffset.end() - 1);
+    for (int i = 0; i < nC; i++) { // ascending, so every face's list is sorted
+        const Collapse& c = _collapses[i];
+        for (int j = 0; j < c._nF; j++) _faceRecords[fill[_fVec(c)[j]]++] = i;
+        for (int j = 0; j < c._nFR; j++) _faceRecords[fill[_fVecR(c)[j]]++] = i;
+    }
+    // measure every region by replaying from full detail down to the base mesh once
+    float complexity = _complexity;
+    if (_complexity != nVerticesCollapsed() + nC) collapseTo(nVerticesCollapsed() + nC);
+    _nodes.resize(nC);
+    vector<int> lastRecord(_vertexPositions.size(), -1); // the collapse that made each vertex
+    vector<vec3> normals;
+    auto addFaces = [&](CollapseNode& node, const int* f, const int& nF) {
+        for (int j = 0; j < nF; j++) {
+            vec3 p[3] = { _vertexPositions[_faces[f[j]][0]], _vertexPositions[_faces[f[j]][1]], _vertexPositions[_faces[f[j]][2]] };
+            for (int k = 0; k < 3; k++) node._radius = fmax(node._radius, distance(node._center, p[k]));
+            vec3 n = cross(p[1] - p[0], p[2] - p[0]);
+            if (length(n) > 0) normals.push_back(normalize(n));
+        }
+    };
+    for (int i = 0; i < nC; i++) {
+        const Collapse& c = _collapses[i];
+        CollapseNode& node = _nodes[i];
+        node._center = c._xyz;
+        node._radius = 0;
+        normals.clear();
+        addFaces(node, _fVec(c), c._nF);
+        addFaces(node, _fVecR(c), c._nFR);
+        _applyCollapse(i);
+        addFaces(node, _fVec(c), c._nF);
+        node._axis = vec3(0, 0, 0);
+        for (int j = 0; j < (int)normals.size(); j++) node._axis += normals[j];
+        node._coneAngle = M_PI;
+        if (length(node._axis) > 0) {
+            node._axis = normalize(node._axis);
+            node._coneAngle = 0;
+            for (int j = 0; j < (int)normals.size(); j++) node._coneAngle = fmax(node._coneAngle, acos(fmin(1.0f, fmax(-1.0f, dot(node._axis, normals[j])))));
+        }
+        node._error = fmax(distance(c._xyz0, c._xyz), distance(c._xyz1, c._xyz));
+        node._parent = -1;
+        node._children[0] = lastRecord[c._v0];
+        node._children[1] = lastRecord[c._v1];
+        for (int k = 0; k < 2; k++) {
+            if (node._children[k] >= 0) _nodes[node._children[k]]._parent = i;
+        }
+        lastRecord[c._v0] = i;
+    }
+    _complexity = nVerticesCollapsed();
+    for (int i = 0; i < nC; i++) { // grow every parent to cover its children. parents always come later
+        const CollapseNode& node = _nodes[i];
+        if (node._parent < 0) continue;
+        CollapseNode& parent = _nodes[node._parent];
+        parent._radius = fmax(parent._radius, distance(parent._center, node._center) + node._radius);
+        parent._coneAngle = fmin(M_PI, fmax(parent._coneAngle, acos(fmin(1.0f, fmax(-1.0f, dot(parent._axis, node._axis)))) + node._coneAngle));
+        parent._error = fmax(parent._error, node._error);
+    }
+    collapseTo(complexity);
+}
+bool MeshObject::_canCollapse(const int& i) { // every earlier collapse on its faces is applied and no later one is
+    if (_applied[i] == true) return false;
+    const Collapse& c = _collapses[i];
+    for (int j = 0; j < c._nF; j++) {
+        int f = _fVec(c)[j];
+        if (_faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f]] != i) return false;
+    }
+    for (int j = 0; j < c._nFR; j++) {
+        int f = _fVecR(c)[j];
+        if (_faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f]] != i) return false;
+    }
+    return true;
+}
+int MeshObject::_splitBlocker(const int& i) {
+    const Collapse& c = _collapses[i];
+    for (int j = 0; j < c._nF; j++) {
+        int f = _fVec(c)[j];
+        int last = _faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f] - 1];
+        if (last != i) return last;
+    }
+    for (int j = 0; j < c._nFR; j++) {
+        int f = _fVecR(c)[j];
+        int last = _faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f] - 1];
+        if (last != i) return last;
+    }
+    return -1;
+}
+void MeshObject::_viewCollapse(const int& i) {
+    const Collapse& c = _collapses[i];
+    _applyCollapse(i);
+    _applied[i] = true;
+    _complexity--;
+    for (int j = 0; j < c._nF; j++) _faceRecordCursor[_fVec(c)[j]]++;
+    for (int j = 0; j < c._nFR; j++) _faceRecordCursor[_fVecR(c)[j]]++;
+    for (int j = 0; j < c._nF; j++) {
+        int f = _fVec(c)[j];
+        if (_faceRecordsOffset[f] + _faceRecordCursor[f] < _faceRecordsOffset[f + 1]) _touchFront(_faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f]]);
+    }
+    for (int j = 0; j < c._nFR; j++) {
+        int f = _fVecR(c)[j];
+        if (_faceRecordsOffset[f] + _faceRecordCursor[f] < _faceRecordsOffset[f + 1]) _touchFront(_faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f]]);
+    }
+    _touchFront(i);
+    if (_nodes[i]._parent >= 0) _touchFront(_nodes[i]._parent);
+}
+void MeshObject::_viewSplit(const int& i) {
+    const Collapse& c = _collapses[i];
+    _applySplit(i);
+    _applied[i] = false;
+    _complexity++;
+    for (int j = 0; j < c._nF; j++) _faceRecordCursor[_fVec(c)[j]]--;
+    for (int j = 0; j < c._nFR; j++) _faceRecordCursor[_fVecR(c)[j]]--;
+    for (int j = 0; j < c._nF; j++) {
+        int f = _fVec(c)[j];
+        if (_faceRecordCursor[f] > 0) _touchFront(_faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f] - 1]);
+    }
+    for (int j = 0; j < c._nFR; j++) {
+        int f = _fVecR(c)[j];
+        if (_faceRecordCursor[f] > 0) _touchFront(_faceRecords[_faceRecordsOffset[f] + _faceRecordCursor[f] - 1]);
+    }
+    _touchFront(i);
+    for (int k = 0; k < 2; k++) {
+        if (_nodes[i]._children[k] >= 0) _touchFront(_nodes[i]._children[k]);
+    }
+}
+void MeshObject::_touchFront(const int& i) {
+    if (_onFront[i] == true) return;
+    _onFront[i] = true;
+    _front.push_back(i);
+}
+void MeshObject::refineView(const mat4& modelView, const mat4& projection, const vec4& viewport) {
+    if (_viewDependent == false) return;
+    mat4 m = projection * modelView;
+    vec4 planes[6]; // view frustum in object space
+    vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    for (int k = 0; k < 3; k++) {
+        vec4 row(m[0][k], m[1][k], m[2][k], m[3][k]);
+        planes[2 * k + 0] = row3 + row;
+        planes[2 * k + 1] = row3 - row;
+    }
+    for (int k = 0; k < 6; k++) planes[k] /= length(vec3(planes[k]));
+    vec3 eye = vec3(inverse(modelView) * vec4(0, 0, 0, 1));
+    float kappa = pixelsPerUnit(projection, viewport[3]);
+    int splits = 0;
+    vector<int> front;
+    front.swap(_front);
+    vector<int> forced;
+    for (int n = 0; n < (int)front.size(); n++) {
+        int i = front[n];
+        bool active = _isActiveNode(i);
+        bool canCollapse = _canCollapse(i);
+        if (active == false && canCollapse == false) {
+            _onFront[i] = false;
+            continue;
+        }
+        _front.push_back(i);
+        const CollapseNode& node = _nodes[i];
+        bool refine = true;
+        for (int k = 0; k < 6; k++) {
+            if (dot(vec3(planes[k]), node._center) + planes[k][3] < -node._radius) refine = false; // outside the view frustum
+        }
+        vec3 toCenter = node._center - eye;
+        float d = length(toCenter);
+        if (refine == true && d > node._radius) {
+            float spread = node._coneAngle + asin(node._radius / d);
+            if (spread < M_PI / 2 && dot(node._axis, toCenter / d) > sin(spread)) refine = false; // every face points away from the eye
+            float z = -(modelView * vec4(node._center, 1))[2];
+            if (refine == true && z > node._radius) refine = node._error * kappa / (z - node._radius) > _pixelTolerance; // screen-space error
+        }
+        if (refine == true && active == true) { // split i, first splitting whatever later collapses its faces depend on
+            forced.clear();
+            forced.push_back(i);
+            while (!forced.empty() && splits < _splitBudget) {
+                int j = forced.back();
+                if (_applied[j] == false) { // already split on the way to another record
+                    forced.pop_back();
+                    continue;
+                }
+                int blocker = _splitBlocker(j);
+                if (blocker >= 0) {
+                    forced.push_back(blocker);
+                    continue;
                 }
+                _viewSplit(j);
+                splits++;
+                forced.pop_back();
             }
         }
+        else if (refine == false && canCollapse == true) _viewCollapse(i);
     }
-    _complexity = fmin(fmax(_vertexPositions.size() - _v0.size(), newComplexity), _vertexPositions.size()); // update the current _complexity
-    // GEOMORPH: small alpha means we are close to the full split
-    if (newCollapseIndex >= _v0.size()) return;
-    _vertexPositions[_v0[newCollapseIndex]] = (1.0f - alpha)*_xyz0[newCollapseIndex] + alpha*_xyz[newCollapseIndex];
-    _vertexPositions[_v1[newCollapseIndex]] = (1.0f - alpha)*_xyz1[newCollapseIndex] + alpha*_xyz[newCollapseIndex];
-    _vertexNormals[_v0[newCollapseIndex]] = (1.0f - alpha)*_n0[newCollapseIndex] + alpha*_n[newCollapseIndex];
-    _vertexNormals[_v1[newCollapseIndex]] = (1.0f - alpha)*_n1[newCollapseIndex] + alpha*_n[newCollapseIndex];
+}
+void MeshObject::setCheckpointBudget(const size_t& bytes) {
+    _checkpointBudget = bytes;
+    _checkpoints.clear();
+    if (_format == "offpm" && _geomReady == true && _checkpointBudget > 0) _buildCheckpoints();
+}
+void MeshObject::_buildCheckpoints() { // walk from the base mesh up to full detail once, snapshotting every _checkpointSpacing collapses
+    _checkpoints.clear();
+    size_t checkpointSize = sizeof(int)*_triangleIndices.size() + sizeof(vec3)*(_vertexPositions.size() + _vertexNormals.size());
+    int nCheckpoints = fmin(_checkpointBudget / checkpointSize, _collapses.size() + 1);
+    if (nCheckpoints < 1) {
+        printf("Checkpoint budget of %i bytes is smaller than one snapshot (%i bytes)\n", (int)_checkpointBudget, (int)checkpointSize);
+        return;
+    }
+    _checkpointSpacing = ceil((float)_collapses.size() / nCheckpoints);
+    if (_checkpointSpacing < 1) _checkpointSpacing = 1;
+    printf("Building %i checkpoints, one every %i collapses\n", nCheckpoints, _checkpointSpacing);
+    float complexity = _complexity;
+    float baseComplexity = nVerticesCollapsed();
+    _checkpoints.reserve(nCheckpoints);
+    for (int j = 0; j < nCheckpoints; j++) {
+        int collapseIndex = (int)_collapses.size() - j*_checkpointSpacing;
+        if (collapseIndex < 0) break;
+        if (_complexity != baseComplexity + _collapses.size() - collapseIndex) collapseTo(baseComplexity + _collapses.size() - collapseIndex); // the first one too, if the budget is set away from the base mesh
+        Checkpoint checkpoint;
+        checkpoint._collapseIndex = collapseIndex;
+        checkpoint._triangleIndices = _triangleIndices;
+        checkpoint._vertexPositions = _vertexPositions;
+        checkpoint._vertexNormals = _vertexNormals;
+        _checkpoints.push_back(checkpoint);
+    }
+    collapseTo(complexity);
+}
+void MeshObject::_seekCheckpoint(const float& newComplexity) { // restore the checkpoint nearest newComplexity if that beats replaying from here
+    float nAll = (float)(nVerticesCollapsed() + _collapses.size());
+    int oldCollapseIndex = fmin(fmax(0, nAll - _complexity), _collapses.size());
+    int newCollapseIndex = fmin(fmax(0, nAll - newComplexity), _collapses.size());
+    int j = floor(((float)_collapses.size() - newCollapseIndex) / _checkpointSpacing + 0.5f);
+    j = fmin(fmax(0, j), _checkpoints.size() - 1);
+    const Checkpoint& checkpoint = _checkpoints[j];
+    // a replayed collapse is dominated by cache misses and costs about as much as copying a few hundred ints
+    int restoreCost = checkpoint._triangleIndices.size() / 256 + checkpoint._vertexPositions.size() / 128;
+    if (abs(checkpoint._collapseIndex - newCollapseIndex) + restoreCost >= abs(oldCollapseIndex - newCollapseIndex)) return;
+    _triangleIndices = checkpoint._triangleIndices;
+    _vertexPositions = checkpoint._vertexPositions;
+    _vertexNormals = checkpoint._vertexNormals;
+    _dirtyTriangles.add(0, _triangleIndices.size());
+    _dirtyPositions.add(0, _vertexPositions.size());
+    _dirtyNormals.add(0, _vertexNormals.size());
+    _bvhDirty = true;
+    for (int f = 0; f < (int)_faces.size(); f++) { // removed faces keep their stale corners, which are never read before they are restored
+        if (_triangleIndices[3 * f + 0] == _triangleIndices[3 * f + 1] && _triangleIndices[3 * f + 1] == _triangleIndices[3 * f + 2]) continue;
+        for (int k = 0; k < 3; k++) _faces[f][k] = _triangleIndices[3 * f + k];
+    }
+    _complexity = nAll - checkpoint._collapseIndex;
+}
+void MeshObject::_makePrefixOrder(const vector<int>& vBase, const vector<int>& fBase) {
+    // Renumber vertices and faces so that the ones a collapse removes come after everything removed by later collapses:
+    // base mesh first, then v1/fVecR of the last collapse, ..., then those of collapse 0. With collapses [0, i) applied
+    // the live mesh is then exactly vertices [0, _prefixVertices[i]) and faces [0, _prefixFaces[i]).
+    int nC = _collapses.size();
+    vector<int> vNew(_vertexPositions.size(), -1);
+    vector<int> fNew(_faces.size(), -1);
+    int nV = 0, nF = 0;
+    for (int i = 0; i < (int)vBase.size(); i++) if (vNew[vBase[i]] == -1) vNew[vBase[i]] = nV++;
+    for (int i = 0; i < (int)fBase.size(); i++) if (fNew[fBase[i]] == -1) fNew[fBase[i]] = nF++;
+    _prefixVertices.resize(nC + 1);
+    _prefixFaces.resize(nC + 1);
+    _prefixVertices[nC] = nV;
+    _prefixFaces[nC] = nF;
+    for (int i = nC - 1; i >= 0; i--) {
+        const Collapse& c = _collapses[i];
+        if (vNew[c._v1] == -1) vNew[c._v1] = nV++;
+        for (int j = 0; j < c._nFR; j++) if (fNew[_fVecR(c)[j]] == -1) fNew[_fVecR(c)[j]] = nF++;
+        _prefixVertices[i] = nV;
+        _prefixFaces[i] = nF;
+    }
+    for (int v = 0; v < (int)vNew.size(); v++) if (vNew[v] == -1) vNew[v] = nV++; // never referenced
+    for (int f = 0; f < (int)fNew.size(); f++) if (fNew[f] == -1) fNew[f] = nF++;
+    vector<vec3> positions(_vertexPositions.size()), normals(_vertexNormals.size());
+    for (int v = 0; v < (int)vNew.size(); v++) {
+        positions[vNew[v]] = _vertexPositions[v];
+        normals[vNew[v]] = _vertexNormals[v];
+    }
+    _vertexPositions.swap(positions);
+    _vertexNormals.swap(normals);
+    vector<Face> faces(_faces.size(), { 0, 0, 0 });
+    fill(_triangleIndices.begin(), _triangleIndices.end(), 0);
+    for (int i = 0; i < (int)fBase.size(); i++) {
+        int f = fNew[fBase[i]];
+        for (int k = 0; k < 3; k++) {
+            faces[f][k] = vNew[_faces[fBase[i]][k]];
+            _triangleIndices[3 * f + k] = faces[f][k];
+        }
+    }
+    _faces.swap(faces);
+    for (int i = 0; i < nC; i++) {
+        Collapse& c = _collapses[i];
+        c._v0 = vNew[c._v0];
+        c._v1 = vNew[c._v1];
+        int* pool = _collapseFaces.data() + c._f;
+        for (int j = 0; j < c._nF1 + c._nFR; j++) pool[j] = fNew[pool[j]]; // fVec1 | fVecR
+        pool += c._nF1 + c._nFR;
+        for (int j = 0; j < 3 * c._nFR; j++) pool[j] = vNew[pool[j]]; // fVecRijk
+        pool += 3 * c._nFR;
+        for (int j = 0; j < c._nF; j++) pool[j] = fNew[pool[j]]; // fVec
+    }
+}
+vec3 MeshObject::_faceNormalSum(const int& v, const int* f, const int& nF) {
+    vec3 n(0, 0, 0);
+    for (int i = 0; i < nF; i++) {
+        const Face& corners = _faces[f[i]];
+        if (corners[0] != v && corners[1] != v && corners[2] != v) continue;
+        vec3 nf = cross(_vertexPositions[corners[1]] - _vertexPositions[corners[0]], _vertexPositions[corners[2]] - _vertexPositions[corners[0]]);
+        float nLength = length(nf);
+        if (nLength > 0) n += nf / nLength;
+    }
+    return n;
 }
 
 void MeshObject::makeAdjacencyFromIndices() {
@@ -1326,4 +3288,1568 @@ void MeshObject::makeAdjacencyFromIndices() {
             _adjacency[f[j]].insert(vv[i]);
         }
     }
-}
\ No newline at end of file
+}
+
+namespace {
+mutex progressiveMeshCacheMutex; // at file scope, since VS2013 does not make function statics thread-safe
+condition_variable progressiveMeshCacheChanged; // a read finished
+map<string, weak_ptr<const ProgressiveMesh>> progressiveMeshCache;
+set<string> progressiveMeshesLoading; // placeholders for the files some thread is reading. others wait for it rather than read them again
+}
+shared_ptr<const ProgressiveMesh> ProgressiveMesh::load(const string& fileName, MeshObject* source) {
+    unique_lock<mutex> lock(progressiveMeshCacheMutex);
+    shared_ptr<const ProgressiveMesh> mesh = progressiveMeshCache[fileName].lock();
+    while (mesh == nullptr && progressiveMeshesLoading.count(fileName) > 0) {
+        progressiveMeshCacheChanged.wait(lock);
+        mesh = progressiveMeshCache[fileName].lock();
+    }
+    if (mesh != nullptr) return mesh;
+    progressiveMeshesLoading.insert(fileName);
+    lock.unlock(); // reading and replaying take a while. loads of other files go ahead meanwhile
+    if (source != nullptr && source->format() == "offpm" && source->viewDependent() == false) {
+        float complexity = source->complexity();
+        float target = source->targetComplexity();
+        bool transitioning = source->transitioning();
+        mesh = make_shared<ProgressiveMesh>(source);
+        source->collapseTo(complexity);
+        if (transitioning == true) source->setTargetComplexity(target);
+    }
+    else {
+        MeshObject copy(fileName);
+        copy.readGeom();
+        if (copy.format() == "offpm") mesh = make_shared<ProgressiveMesh>(&copy);
+    }
+    lock.lock();
+    progressiveMeshesLoading.erase(fileName);
+    if (mesh != nullptr) progressiveMeshCache[fileName] = mesh;
+    lock.unlock();
+    progressiveMeshCacheChanged.notify_all();
+    return mesh;
+}
+ProgressiveMesh::ProgressiveMesh(MeshObject* source) : _positionBufferID(0), _normalBufferID(0) {
+    // Replay the collapses from full detail, giving the vertex each one makes a number of its own. Positions then never
+    // change, and a LOD is only a matter of which versions the index buffer names.
+    source->collapseTo(source->nVertices());
+    int nC = source->_collapses.size();
+    _nFull = source->_vertexPositions.size();
+    _nBase = source->nVerticesCollapsed();
+    _positions = source->_vertexPositions;
+    _normals = source->_vertexNormals;
+    _positions.resize(_nFull + nC);
+    _normals.resize(_nFull + nC);
+    _baseIndices = source->_triangleIndices;
+    _from.resize(2 * nC);
+    _cornerOffset.assign(1, 0);
+    _corners.reserve(8 * nC);
+    _cornersFrom.reserve(8 * nC);
+    vector<int> current(_nFull); // the version each vertex is at
+    for (int v = 0; v < _nFull; v++) current[v] = v;
+    for (int i = 0; i < nC; i++) {
+        const Collapse& c = source->_collapses[i];
+        _from[2 * i + 0] = current[c._v0];
+        _from[2 * i + 1] = current[c._v1];
+        const int* fVec = source->_fVec(c);
+        for (int j = 0; j < c._nF; j++) { // every face around the merged vertex, whichever of the pair it had
+            for (int k = 0; k < 3; k++) {
+                int corner = 3 * fVec[j] + k;
+                if (_baseIndices[corner] != _from[2 * i + 0] && _baseIndices[corner] != _from[2 * i + 1]) continue;
+                _corners.push_back(corner);
+                _cornersFrom.push_back(_baseIndices[corner]);
+                _baseIndices[corner] = version(i);
+            }
+        }
+        _cornerOffset.push_back(_corners.size());
+        source->_applyCollapse(i); // for the normal MeshObject gives the merged vertex
+        _positions[version(i)] = source->_vertexPositions[c._v0];
+        _normals[version(i)] = source->_vertexNormals[c._v0];
+        current[c._v0] = version(i);
+    }
+    source->_complexity = _nBase;
+    _prefixFaces = source->_prefixFaces;
+    _errorCurve = source->_errorCurve;
+    _errorHull = source->_errorHull;
+    _lo = vec3(INFINITY, INFINITY, INFINITY);
+    _hi = -_lo;
+    for (int v = 0; v < (int)_positions.size(); v++) {
+        if (any(isnan(_positions[v])) == true) continue;
+        _lo = min(_lo, _positions[v]);
+        _hi = max(_hi, _positions[v]);
+    }
+    if (_lo[0] > _hi[0]) _lo = _hi = vec3(0, 0, 0);
+    vec3 extent = _hi - _lo;
+    _quantizationCenter = 0.5f * (_lo + _hi);
+    _quantizationStep = fmax(fmax(extent[0], fmax(extent[1], extent[2])) / 65534.0f, 1e-20); // as MeshObject::_fitQuantization
+}
+ProgressiveMesh::~ProgressiveMesh() {
+    if (_positionBufferID == 0) return;
+    GLuint buffers[2] = { _positionBufferID, _normalBufferID };
+    glDeleteBuffers(2, buffers);
+}
+void ProgressiveMesh::bindBuffers() const {
+    if (_positionBufferID == 0) {
+        vector<i16vec4> positions(_positions.size());
+        vector<i8vec4> normals(_normals.size());
+        for (int v = 0; v < (int)_positions.size(); v++) {
+            positions[v] = quantizePosition(_positions[v], _quantizationCenter, _quantizationStep);
+            normals[v] = packNormal(_normals[v]);
+        }
+        glGenBuffers(1, &_positionBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, _positionBufferID);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(i16vec4)*positions.size(), positions.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &_normalBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(i8vec4)*normals.size(), normals.data(), GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, _positionBufferID);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_SHORT, sizeof(i16vec4), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_BYTE, sizeof(i8vec4), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+size_t ProgressiveMesh::nBytes() const {
+    size_t n = sizeof(vec3) * (_positions.capacity() + _normals.capacity());
+    n += sizeof(int) * (_baseIndices.capacity() + _from.capacity() + _cornerOffset.capacity() + _corners.capacity() + _cornersFrom.capacity() + _prefixFaces.capacity() + _errorHull.capacity());
+    return n + sizeof(float) * _errorCurve.capacity();
+}
+
+MeshInstance::MeshInstance(shared_ptr<const ProgressiveMesh> mesh) : Object(), _mesh(mesh), _collapseIndex(mesh->nCollapses()), _indices(mesh->baseIndices()),
+    _vertexArrayID(0), _indexBufferID(0), _lodTarget(-1), _morphFrames(8), _lodFrame(0), _windowSize(256), _windowFrom(0), _windowTo(0), _collapsing(false),
+    _morphArrayID(0), _morphPositionBufferID(0), _morphNormalBufferID(0), _morphIndexBufferID(0) {}
+MeshInstance::~MeshInstance() {
+    GLuint buffers[4] = { _indexBufferID, _morphPositionBufferID, _morphNormalBufferID, _morphIndexBufferID };
+    bindVertexArray(0);
+    if (_vertexArrayID != 0) glDeleteVertexArrays(1, &_vertexArrayID);
+    if (_morphArrayID != 0) glDeleteVertexArrays(1, &_morphArrayID);
+    if (_vertexArrayID != 0 || _morphArrayID != 0) glDeleteBuffers(4, buffers); // zeros are ignored
+}
+size_t MeshInstance::nBytes() {
+    size_t n = sizeof(int) * (_indices.capacity() + _morphFaces.capacity() + _morphSaved.capacity() + _morphIndices.capacity());
+    return n + sizeof(vec3) * (_morphFine.capacity() + _morphCoarse.capacity() + _morphFineNormals.capacity() + _morphCoarseNormals.capacity() + _morphOut.capacity());
+}
+void MeshInstance::collapseTo(const float& complexity) {
+    _closeWindow();
+    _lodTarget = -1;
+    _apply(_mesh->collapseIndexAt(complexity));
+}
+void MeshInstance::setTargetComplexity(const float& complexity) {
+    _lodTarget = _mesh->collapseIndexAt(complexity);
+}
+void MeshInstance::_apply(const int& collapseIndex) {
+    for (; _collapseIndex < collapseIndex; _collapseIndex++) {
+        const int* corners = _mesh->corners(_collapseIndex);
+        for (int j = 0; j < _mesh->nCorners(_collapseIndex); j++) {
+            _indices[corners[j]] = _mesh->version(_collapseIndex);
+            _dirtyIndices.add(corners[j]);
+        }
+    }
+    for (; _collapseIndex > collapseIndex; _collapseIndex--) {
+        int i = _collapseIndex - 1;
+        const int* corners = _mesh->corners(i);
+        const int* cornersFrom = _mesh->cornersFrom(i);
+        for (int j = 0; j < _mesh->nCorners(i); j++) {
+            _indices[corners[j]] = cornersFrom[j];
+            _dirtyIndices.add(corners[j]);
+        }
+    }
+}
+void MeshInstance::_updateLOD() {
+    if (_windowTo == _windowFrom) {
+        if (_lodTarget == _collapseIndex) {
+            _lodTarget = -1;
+            return;
+        }
+        _collapsing = _lodTarget > _collapseIndex;
+        if (_collapsing == true) _openWindow(_collapseIndex, fmin(_lodTarget, _collapseIndex + _windowSize));
+        else {
+            int to = _collapseIndex;
+            _apply(fmax(_lodTarget, _collapseIndex - _windowSize)); // split first. the morph buffers hide it until it is blended in
+            _openWindow(_collapseIndex, to);
+        }
+        _lodFrame = 0;
+    }
+    _lodFrame++;
+    if (_lodFrame < _morphFrames) return;
+    int to = _windowTo;
+    _closeWindow();
+    if (_collapsing == true) _apply(to);
+}
+void MeshInstance::_openWindow(const int& from, const int& to) {
+    _windowFrom = from;
+    _windowTo = to;
+    unordered_map<int, int> next; // version -> the version a window collapse merges it into
+    for (int i = from; i < to; i++) next[_mesh->from(i)[0]] = next[_mesh->from(i)[1]] = _mesh->version(i);
+    auto coarse = [&](int v) { // where v ends up once the whole window is collapsed
+        for (auto it = next.find(v); it != next.end(); it = next.find(v)) v = it->second;
+        return v;
+    };
+    _morphFaces.clear(); // everything that touches a vertex the window merges: faces it rewrites, and faces it removes
+    for (int i = from; i < to; i++) {
+        for (int j = 0; j < _mesh->nCorners(i); j++) _morphFaces.push_back(_mesh->corners(i)[j] / 3);
+    }
+    for (int f = _mesh->nFacesAt(to); f < _mesh->nFacesAt(from); f++) _morphFaces.push_back(f);
+    sort(_morphFaces.begin(), _morphFaces.end());
+    _morphFaces.erase(unique(_morphFaces.begin(), _morphFaces.end()), _morphFaces.end());
+    unordered_map<int, int> local; // version -> morph vertex
+    _morphSaved.clear();
+    _morphIndices.clear();
+    _morphFine.clear();
+    _morphCoarse.clear();
+    _morphFineNormals.clear();
+    _morphCoarseNormals.clear();
+    for (int n = 0; n < (int)_morphFaces.size(); n++) {
+        int f = _morphFaces[n];
+        for (int k = 0; k < 3; k++) {
+            int v = _indices[3 * f + k];
+            _morphSaved.push_back(v);
+            auto it = local.find(v);
+            if (it == local.end()) {
+                it = local.insert(make_pair(v, (int)_morphFine.size())).first;
+                int c = coarse(v);
+                _morphFine.push_back(_mesh->position(v));
+                _morphCoarse.push_back(_mesh->position(c));
+                _morphFineNormals.push_back(_mesh->normal(v));
+                _morphCoarseNormals.push_back(_mesh->normal(c));
+            }
+            _morphIndices.push_back(it->second);
+        }
+        for (int k = 1; k < 3; k++) _indices[3 * f + k] = _indices[3 * f]; // degenerate, so the shared buffer draws nothing there
+        _dirtyIndices.add(3 * f, 3 * f + 3);
+    }
+    if (_morphArrayID == 0) {
+        glGenVertexArrays(1, &_morphArrayID);
+        bindVertexArray(_morphArrayID);
+        glGenBuffers(1, &_morphPositionBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, _morphPositionBufferID);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, 0);
+        glGenBuffers(1, &_morphNormalBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, _morphNormalBufferID);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, 0, 0);
+        glGenBuffers(1, &_morphIndexBufferID);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _morphIndexBufferID);
+        bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    bindElementBuffer(_morphIndexBufferID);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*_morphIndices.size(), _morphIndices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+void MeshInstance::_closeWindow() {
+    if (_windowTo == _windowFrom) return;
+    for (int n = 0; n < (int)_morphFaces.size(); n++) {
+        int f = _morphFaces[n];
+        for (int k = 0; k < 3; k++) _indices[3 * f + k] = _morphSaved[3 * n + k];
+        _dirtyIndices.add(3 * f, 3 * f + 3);
+    }
+    _morphFaces.clear();
+    _morphSaved.clear();
+    _windowFrom = _windowTo = 0;
+}
+void MeshInstance::_drawMorph(const float& alpha) {
+    int n = _morphFine.size();
+    if (n == 0) return;
+    _morphOut.resize(2 * n);
+    for (int i = 0; i < n; i++) {
+        _morphOut[i] = _morphFine[i] + alpha*(_morphCoarse[i] - _morphFine[i]);
+        _morphOut[n + i] = _morphFineNormals[i] + alpha*(_morphCoarseNormals[i] - _morphFineNormals[i]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, _morphPositionBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*n, &_morphOut[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, _morphNormalBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3)*n, &_morphOut[n], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glEnable(GL_NORMALIZE); // the blended normals are a little short
+    bindVertexArray(_morphArrayID);
+    glDrawElements(GL_TRIANGLES, _morphIndices.size(), GL_UNSIGNED_INT, 0);
+    glDisable(GL_NORMALIZE);
+}
+void MeshInstance::doDraw() {
+    if (_lodTarget >= 0) {
+        _updateLOD();
+        glutPostRedisplay(); // the transition needs more frames
+    }
+    bool shortIndices = _mesh->shortIndices();
+    if (_vertexArrayID == 0) {
+        glGenVertexArrays(1, &_vertexArrayID);
+        bindVertexArray(_vertexArrayID);
+        _mesh->bindBuffers();
+        glGenBuffers(1, &_indexBufferID);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBufferID);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (shortIndices == true ? sizeof(unsigned short) : sizeof(int))*_indices.size(), NULL, GL_DYNAMIC_DRAW);
+        bindVertexArray(0);
+        _dirtyIndices.clear();
+        _dirtyIndices.add(0, _indices.size());
+    }
+    if (_dirtyIndices.empty() == false) {
+        bindElementBuffer(_indexBufferID);
+        uploadIndexSpans(_dirtyIndices, _indices, shortIndices);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    glColor4f(1, 1, 1, 1); // the shared buffers have no colors
+    glPushMatrix();
+    glTranslatef(_mesh->quantizationCenter()[0], _mesh->quantizationCenter()[1], _mesh->quantizationCenter()[2]);
+    glScalef(_mesh->quantizationStep(), _mesh->quantizationStep(), _mesh->quantizationStep());
+    glEnable(GL_RESCALE_NORMAL);
+    bindVertexArray(_vertexArrayID);
+    glDrawElements(GL_TRIANGLES, 3 * _mesh->nFacesAt(_collapseIndex), shortIndices == true ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, 0);
+    glDisable(GL_RESCALE_NORMAL);
+    glPopMatrix();
+    if (_windowTo > _windowFrom) { // the faces around the window, blended between its ends
+        float t = fmin(1, _lodFrame / (float)_morphFrames);
+        _drawMorph(_collapsing == true ? t : 1 - t);
+    }
+}
+
+namespace {
+const char * INSTANCED_VERTEX_SHADER = // GLSL 1.20, so it runs wherever the fixed-function code does
+    "#version 120\n"
+    "attribute mat4 instanceMatrix;\n"
+    "attribute vec4 instanceColor;\n"
+    "uniform vec3 quantizationCenter;\n"
+    "uniform float quantizationStep;\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "    vec4 position = instanceMatrix * vec4(quantizationCenter + quantizationStep * gl_Vertex.xyz, 1.0);\n"
+    "    color = instanceColor;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * position;\n"
+    "}\n";
+const char * INSTANCED_FRAGMENT_SHADER =
+    "#version 120\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+}
+InstancedMesh::InstancedMesh(shared_ptr<const ProgressiveMesh> mesh, const int& nBuckets) : Object(), _mesh(mesh), _vertexArrayID(0), _instanceBufferID(0),
+    _shader(nullptr), _matrixLocation(-1), _colorLocation(-1), _centerLocation(-1), _stepLocation(-1), _pixelTolerance(1), _instancing(true),
+    _nCulled(0), _nDrawCalls(0), _submitTime(0) {
+    float full = mesh->complexityAt(0);
+    for (int b = 0; b < nBuckets; b++) {
+        int index = mesh->collapseIndexAt(full / (1 << b));
+        if (b > 0 && index == _bucketIndex.back()) break; // the mesh is already at its base
+        _bucketIndex.push_back(index);
+    }
+    _bucketCount.assign(_bucketIndex.size(), 0);
+    _bucketStart.assign(_bucketIndex.size(), 0);
+}
+InstancedMesh::~InstancedMesh() {
+    if (_vertexArrayID == 0) return;
+    bindVertexArray(0);
+    glDeleteVertexArrays(1, &_vertexArrayID);
+    glDeleteBuffers(_bucketBufferIDs.size(), _bucketBufferIDs.data());
+    glDeleteBuffers(1, &_instanceBufferID);
+    delete _shader;
+}
+int InstancedMesh::add(const mat4& transform, const vec4& color) {
+    _transforms.push_back(mat4());
+    _colors.push_back(u8vec4());
+    _centers.push_back(vec3());
+    _radii.push_back(0);
+    _scales.push_back(0);
+    set(_transforms.size() - 1, transform, color);
+    return _transforms.size() - 1;
+}
+void InstancedMesh::set(const int& i, const mat4& transform, const vec4& color) {
+    _transforms[i] = transform;
+    _colors[i] = packColor(color);
+    _scales[i] = fmax(length(vec3(transform[0])), fmax(length(vec3(transform[1])), length(vec3(transform[2]))));
+    vec3 lo, hi;
+    _mesh->bounds(lo, hi);
+    _centers[i] = vec3(transform * vec4(0.5f*(lo + hi), 1));
+    _radii[i] = 0.5f*length(hi - lo)*_scales[i];
+    invalidateBounds();
+}
+void InstancedMesh::clear() {
+    _transforms.clear();
+    _colors.clear();
+    _centers.clear();
+    _radii.clear();
+    _scales.clear();
+    invalidateBounds();
+}
+bool InstancedMesh::localBounds(vec3& lo, vec3& hi) {
+    if (_transforms.empty() == true) return false;
+    lo = vec3(INFINITY, INFINITY, INFINITY);
+    hi = -lo;
+    for (int i = 0; i < (int)_centers.size(); i++) {
+        lo = min(lo, _centers[i] - _radii[i]);
+        hi = max(hi, _centers[i] + _radii[i]);
+    }
+    return true;
+}
+void InstancedMesh::_createBuffers() {
+    bool shortIndices = _mesh->shortIndices();
+    glGenVertexArrays(1, &_vertexArrayID);
+    bindVertexArray(_vertexArrayID);
+    _mesh->bindBuffers();
+    _bucketBufferIDs.resize(_bucketIndex.size());
+    glGenBuffers(_bucketBufferIDs.size(), _bucketBufferIDs.data());
+    MeshInstance walker(_mesh); // starts at the base, so walk the buckets coarsest first
+    for (int b = _bucketIndex.size() - 1; b >= 0; b--) {
+        walker.collapseTo(_mesh->complexityAt(_bucketIndex[b]));
+        int n = 3 * _mesh->nFacesAt(_bucketIndex[b]); // the faces past these are collapsed away
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _bucketBufferIDs[b]);
+        if (shortIndices == true) {
+            vector<unsigned short> packed(walker.indices().begin(), walker.indices().begin() + n);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*n, packed.data(), GL_STATIC_DRAW);
+        }
+        else glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*n, walker.indices().data(), GL_STATIC_DRAW);
+    }
+    if (GLEW_VERSION_3_3 == GL_TRUE) { // glVertexAttribDivisor
+        _shader = Shader::fromSource("instanced mesh", INSTANCED_VERTEX_SHADER, INSTANCED_FRAGMENT_SHADER);
+        _matrixLocation = _shader->attributeLocation("instanceMatrix");
+        _colorLocation = _shader->attributeLocation("instanceColor");
+        _centerLocation = _shader->uniformLocation("quantizationCenter");
+        _stepLocation = _shader->uniformLocation("quantizationStep");
+    }
+    else printf("No GL 3.3, so instanced meshes draw one copy at a time\n");
+    if (_shader != nullptr && (_shader->linked() == false || _matrixLocation < 0 || _colorLocation < 0)) { // -1 + c would point the instance data at the mesh's own attributes
+        printf("The instancing shader failed, so instanced meshes draw one copy at a time\n");
+        delete _shader;
+        _shader = nullptr;
+    }
+    if (_shader != nullptr) {
+        glGenBuffers(1, &_instanceBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, _instanceBufferID);
+        for (int c = 0; c < 4; c++) {
+            glEnableVertexAttribArray(_matrixLocation + c);
+            glVertexAttribDivisor(_matrixLocation + c, 1);
+        }
+        glEnableVertexAttribArray(_colorLocation);
+        glVertexAttribDivisor(_colorLocation, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    bindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+void InstancedMesh::_pointInstances(const int& start) {
+    glBindBuffer(GL_ARRAY_BUFFER, _instanceBufferID);
+    size_t offset = sizeof(InstanceData)*start;
+    for (int c = 0; c < 4; c++) glVertexAttribPointer(_matrixLocation + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + sizeof(vec4)*c));
+    glVertexAttribPointer(_colorLocation, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, _color)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void InstancedMesh::doDraw() {
+    typedef chrono::high_resolution_clock Clock;
+    auto start = Clock::now();
+    if (_vertexArrayID == 0) _createBuffers();
+    bool instancing = _instancing == true && _shader != nullptr;
+
+    // Cull each copy, then give it the coarsest bucket whose error stays within the tolerance on screen, as MeshObject::selectComplexity
+    mat4 modelView, projection;
+    GLint viewport[4];
+    glGetFloatv(GL_MODELVIEW_MATRIX, &modelView[0][0]);
+    glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    Frustum frustum(projection * modelView);
+    float kappa = pixelsPerUnit(projection, viewport[3]);
+    const vector<float>& curve = _mesh->errorCurve();
+    int n = _transforms.size();
+    _instanceBucket.resize(n);
+    _bucketCount.assign(_bucketIndex.size(), 0);
+    _nCulled = 0;
+    for (int i = 0; i < n; i++) {
+        if (frustum.outside(_centers[i], _radii[i]) == true) {
+            _instanceBucket[i] = -1;
+            _nCulled++;
+            continue;
+        }
+        float z = -(modelView * vec4(_centers[i], 1))[2];
+        int allowed = 0; // collapses the error lets us apply
+        if (z > _radii[i]) allowed = collapseIndexForError(curve, _pixelTolerance * (z - _radii[i]) / kappa / _scales[i]); // tolerance in the mesh's own units
+        int b = _bucketIndex.size() - 1;
+        while (b > 0 && _bucketIndex[b] > allowed) b--;
+        _instanceBucket[i] = b;
+        _bucketCount[b]++;
+    }
+    for (int b = 1; b < (int)_bucketIndex.size(); b++) _bucketStart[b] = _bucketStart[b - 1] + _bucketCount[b - 1];
+    _instanceData.resize(n - _nCulled);
+    vector<int> next(_bucketStart);
+    for (int i = 0; i < n; i++) {
+        if (_instanceBucket[i] == -1) continue;
+        InstanceData& data = _instanceData[next[_instanceBucket[i]]++];
+        data._transform = _transforms[i];
+        data._color = _colors[i];
+    }
+
+    GLenum indexType = _mesh->shortIndices() == true ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    _nDrawCalls = 0;
+    bindVertexArray(_vertexArrayID);
+    if (instancing == true) {
+        glBindBuffer(GL_ARRAY_BUFFER, _instanceBufferID);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData)*_instanceData.size(), _instanceData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLint previous = 0; // the world may have a program of its own bound
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+        _shader->link();
+        glUniform3fv(_centerLocation, 1, &_mesh->quantizationCenter()[0]);
+        glUniform1f(_stepLocation, _mesh->quantizationStep());
+        for (int b = 0; b < (int)_bucketIndex.size(); b++) {
+            if (_bucketCount[b] == 0) continue;
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _bucketBufferIDs[b]);
+            _pointInstances(_bucketStart[b]);
+            glDrawElementsInstanced(GL_TRIANGLES, 3 * _mesh->nFacesAt(_bucketIndex[b]), indexType, 0, _bucketCount[b]);
+            _nDrawCalls++;
+        }
+        glUseProgram(previous);
+    }
+    else { // what as many MeshInstances would do, less their index uploads
+        for (int b = 0; b < (int)_bucketIndex.size(); b++) {
+            if (_bucketCount[b] == 0) continue;
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _bucketBufferIDs[b]);
+            for (int i = _bucketStart[b]; i < _bucketStart[b] + _bucketCount[b]; i++) {
+                glColor4ubv(&_instanceData[i]._color[0]);
+                glPushMatrix();
+                glMultMatrixf(&_instanceData[i]._transform[0][0]);
+                glTranslatef(_mesh->quantizationCenter()[0], _mesh->quantizationCenter()[1], _mesh->quantizationCenter()[2]);
+                glScalef(_mesh->quantizationStep(), _mesh->quantizationStep(), _mesh->quantizationStep());
+                glDrawElements(GL_TRIANGLES, 3 * _mesh->nFacesAt(_bucketIndex[b]), indexType, 0);
+                glPopMatrix();
+                _nDrawCalls++;
+            }
+        }
+    }
+    _submitTime = chrono::duration<double, micro>(Clock::now() - start).count();
+}
+void Scene::benchmarkInstancing(shared_ptr<const ProgressiveMesh> mesh, int nInstances) {
+    vec3 lo, hi;
+    mesh->bounds(lo, hi);
+    float spacing = 1.25f * fmax(length(hi - lo), 1e-6f);
+    int side = (int)ceil(sqrt((float)nInstances));
+    InstancedMesh grid(mesh);
+    for (int i = 0; i < nInstances; i++) {
+        vec3 offset = spacing * vec3(i % side - 0.5f*(side - 1), i / side - 0.5f*(side - 1), 0);
+        grid.add(translate(mat4(), offset - 0.5f*(lo + hi)), vec4((i % side) / (float)side, (i / side) / (float)side, 1, 1));
+    }
+
+    glMatrixMode(GL_PROJECTION); // a camera of our own that sees the whole grid, tilted so the far rows get coarse
+    glPushMatrix();
+    glLoadIdentity();
+    gluPerspective(45, 1, 0.01f*spacing, 4 * side*spacing);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glTranslatef(0, 0, -1.2f * side*spacing);
+    glRotatef(-60, 1, 0, 0);
+
+    const int nFrames = 10;
+    double time[2] = { 0, 0 };
+    int nDrawCalls[2] = { 0, 0 };
+    for (int pass = 0; pass < 2; pass++) {
+        grid.setInstancing(pass == 0);
+        grid.doDraw(); // the first frame uploads the buffers
+        for (int frame = 0; frame < nFrames; frame++) {
+            grid.doDraw();
+            time[pass] += grid.submitTime() / nFrames;
+        }
+        nDrawCalls[pass] = grid.nDrawCalls();
+    }
+    bindVertexArray(0); // doDraw leaves its vertex array bound for whatever the queue draws next
+    glFinish();
+
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+
+    printf("Instancing benchmark, %d copies of %d faces (%d culled)\n", nInstances, mesh->nFaces(), grid.nCulled());
+    for (int b = 0; b < grid.nBuckets(); b++) printf("  bucket %d: %.0f vertices, %d copies\n", b, grid.bucketComplexity(b), grid.bucketSize(b));
+    printf("  instanced %.3f ms in %d draws, one by one %.3f ms in %d draws\n", time[0] / 1000, nDrawCalls[0], time[1] / 1000, nDrawCalls[1]);
+}
+void Scene::makeIcosphere(const int& nFaces, vector<vec3>& positions, vector<int>& indices) {
+    float t = (1 + sqrt(5.0f)) / 2;
+    positions = { vec3(-1, t, 0), vec3(1, t, 0), vec3(-1, -t, 0), vec3(1, -t, 0), vec3(0, -1, t), vec3(0, 1, t),
+        vec3(0, -1, -t), vec3(0, 1, -t), vec3(t, 0, -1), vec3(t, 0, 1), vec3(-t, 0, -1), vec3(-t, 0, 1) };
+    indices = { 0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+        3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1 };
+    int nLevels = 0;
+    while (20.0 * pow(4.0, nLevels + 0.5) < nFaces) nLevels++; // nearest in ratio
+    for (int level = 0; level < nLevels; level++) {
+        unordered_map<long long, int> midpoint;
+        long long nCoarse = positions.size(); // edges only join vertices of the level before
+        auto split = [&](int a, int b) {
+            long long key = (long long)fmin(a, b) * nCoarse + (long long)fmax(a, b);
+            auto it = midpoint.find(key);
+            if (it != midpoint.end()) return it->second;
+            positions.push_back(0.5f * (positions[a] + positions[b]));
+            midpoint[key] = positions.size() - 1;
+            return (int)positions.size() - 1;
+        };
+        vector<int> finer;
+        finer.reserve(4 * indices.size());
+        for (int f = 0; f < (int)indices.size(); f += 3) {
+            int a = indices[f], b = indices[f + 1], c = indices[f + 2];
+            int ab = split(a, b), bc = split(b, c), ca = split(c, a);
+            finer.insert(finer.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+        }
+        indices.swap(finer);
+    }
+    for (int v = 0; v < (int)positions.size(); v++) positions[v] = normalize(positions[v]);
+}
+void Scene::makeTerrain(const int& nFaces, vector<vec3>& positions, vector<int>& indices) {
+    int n = fmax(1, round(sqrt(nFaces / 2.0)));
+    mt19937 random(7); // the same terrain every run
+    uniform_real_distribution<float> noise(-1, 1);
+    positions.resize((n + 1) * (n + 1));
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            float u = x / (float)n, v = y / (float)n;
+            float height = 0.1f * sin(6 * u) * cos(5 * v) + 0.03f * sin(17 * u + 3 * v) + 0.01f * cos(41 * v - 7 * u) + 0.002f * noise(random);
+            positions[y * (n + 1) + x] = vec3(u, v, height);
+        }
+    }
+    indices.clear();
+    indices.reserve(6 * n * n);
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int v = y * (n + 1) + x;
+            indices.insert(indices.end(), { v, v + 1, v + n + 2, v, v + n + 2, v + n + 1 });
+        }
+    }
+}
+void Scene::makeTorusKnot(const int& nFaces, vector<vec3>& positions, vector<int>& indices) {
+    int nAround = fmax(3, round(sqrt(nFaces / 16.0))); // eight times as many rings as vertices around, so the quads stay about square
+    int nAlong = fmax(3, round(nFaces / (2.0 * nAround)));
+    const float pi = 3.14159265f, radius = 0.25f, dt = 1e-3f;
+    auto knot = [](float t) { return vec3((2 + cos(3 * t)) * cos(2 * t), (2 + cos(3 * t)) * sin(2 * t), sin(3 * t)); };
+    positions.resize(nAlong * nAround);
+    for (int i = 0; i < nAlong; i++) {
+        float t = 2 * pi * i / nAlong;
+        vec3 c = knot(t), before = knot(t - dt), after = knot(t + dt);
+        vec3 tangent = normalize(after - before);
+        vec3 binormal = normalize(cross(tangent, after + before - 2.0f * c)); // the Frenet frame, which closes up since the curve does
+        vec3 normal = cross(binormal, tangent);
+        for (int j = 0; j < nAround; j++) {
+            float a = 2 * pi * j / nAround;
+            positions[i * nAround + j] = c + radius * (cos(a) * normal + sin(a) * binormal);
+        }
+    }
+    indices.clear();
+    indices.reserve(6 * nAlong * nAround);
+    for (int i = 0; i < nAlong; i++) {
+        for (int j = 0; j < nAround; j++) {
+            int a = i * nAround + j, b = i * nAround + (j + 1) % nAround;
+            int c = (i + 1) % nAlong * nAround + j, d = (i + 1) % nAlong * nAround + (j + 1) % nAround;
+            indices.insert(indices.end(), { a, c, d, a, d, b });
+        }
+    }
+}
+void Scene::makeFan(const int& nFaces, vector<vec3>& positions, vector<int>& indices) {
+    int nRim = fmax(3, nFaces / 2);
+    const float pi = 3.14159265f;
+    positions.resize(nRim + 2);
+    positions[0] = vec3(0, 0, 1);
+    positions[1] = vec3(0, 0, -1);
+    for (int k = 0; k < nRim; k++) { // the radius and height zigzag, so neighboring slivers are far from coplanar
+        float a = 2 * pi * k / nRim, r = 1 + 0.5f * (k % 3);
+        positions[k + 2] = vec3(r * cos(a), r * sin(a), 0.3f * (k % 2));
+    }
+    indices.clear();
+    indices.reserve(6 * nRim);
+    for (int k = 0; k < nRim; k++) {
+        int a = k + 2, b = (k + 1) % nRim + 2;
+        indices.insert(indices.end(), { 0, a, b, 1, b, a });
+    }
+}
+bool Scene::checkSimplify(const vector<vec3>& positions, const vector<int>& indices) {
+    MeshObject mesh("");
+    mesh.setGeom(positions, indices);
+    mesh.setGuardTopology(true);
+    int nFaces = indices.size() / 3;
+    vector<vec3> before(nFaces), after(nFaces);
+    auto faceNormals = [&](vector<vec3>& normals, const vector<int>& faces) {
+        const vector<vec3>& p = mesh.vertexPositions();
+        const vector<int>& t = mesh.triangleIndices();
+        for (int i = 0; i < (int)faces.size(); i++) {
+            int f = faces[i];
+            normals[f] = cross(p[t[3 * f + 1]] - p[t[3 * f]], p[t[3 * f + 2]] - p[t[3 * f]]);
+        }
+    };
+    faceNormals(before, mesh.visibleFaces());
+    int nSteps = 0;
+    while (mesh.quadricSimplify() == true) {
+        nSteps++;
+        vector<int> faces = mesh.visibleFaces();
+        const vector<int>& t = mesh.triangleIndices();
+        vector<pair<int, int>> edges; // directed. each may appear once, or a third face or a flipped neighbor has joined the edge
+        edges.reserve(3 * faces.size());
+        for (int i = 0; i < (int)faces.size(); i++) {
+            int f = faces[i];
+            for (int k = 0; k < 3; k++) {
+                int a = t[3 * f + k], b = t[3 * f + (k + 1) % 3];
+                if (a == b) {
+                    printf("checkSimplify: face %i is degenerate after %i steps\n", f, nSteps);
+                    return false;
+                }
+                edges.push_back(pair<int, int>(a, b));
+            }
+        }
+        sort(edges.begin(), edges.end());
+        vector<pair<int, int>>::iterator repeat = adjacent_find(edges.begin(), edges.end());
+        if (repeat != edges.end()) {
+            printf("checkSimplify: edge %i %i is not manifold after %i steps\n", repeat->first, repeat->second, nSteps);
+            return false;
+        }
+        faceNormals(after, faces);
+        for (int i = 0; i < (int)faces.size(); i++) {
+            if (dot(before[faces[i]], after[faces[i]]) >= 0) continue;
+            printf("checkSimplify: face %i turned over after %i steps\n", faces[i], nSteps);
+            return false;
+        }
+        before.swap(after);
+    }
+    printf("checkSimplify: %i vertices, %i faces simplified in %i steps to %i faces\n", (int)positions.size(), nFaces, nSteps, (int)mesh.visibleFaces().size());
+    return true;
+}
+bool Scene::checkInstance(const vector<vec3>& positions, const vector<int>& indices) {
+    string pmFileName;
+    {
+        MeshObject simplified("check_instance.off"); // only names the output
+        simplified.setGeom(positions, indices);
+        simplified.setVerbose(false);
+        while (simplified.quadricSimplify() == true);
+        simplified.makeProgressiveMeshFile();
+        pmFileName = simplified.outFileName();
+    }
+
+    MeshObject object(pmFileName);
+    object.readGeom();
+    int base = object.nVerticesCollapsed(), full = object.nVertices();
+    int middle = (base + full) / 2;
+    object.collapseTo(middle); // load should replay it and put it back here
+    shared_ptr<const ProgressiveMesh> mesh = ProgressiveMesh::load(pmFileName, &object);
+    if (mesh == nullptr || object.complexity() != middle) {
+        printf("checkInstance: load did not leave the MeshObject at its LOD\n");
+        return false;
+    }
+    if (ProgressiveMesh::load(pmFileName) != mesh) {
+        printf("checkInstance: a second load read the file again\n");
+        return false;
+    }
+    MeshInstance instance(mesh);
+    typedef array<float, 9> Triangle; // corner positions, starting from the least, so the two numberings compare
+    auto addTriangle = [](vector<Triangle>& triangles, const vec3& a, const vec3& b, const vec3& c) {
+        vec3 p[3] = { a, b, c };
+        int first = 0;
+        for (int k = 1; k < 3; k++) {
+            if (lexicographical_compare(&p[k][0], &p[k][0] + 3, &p[first][0], &p[first][0] + 3) == true) first = k;
+        }
+        Triangle t;
+        for (int k = 0; k < 3; k++) {
+            for (int i = 0; i < 3; i++) t[3 * k + i] = p[(first + k) % 3][i];
+        }
+        triangles.push_back(t);
+    };
+    for (int step = 0; step <= 8; step++) {
+        int complexity = base + (full - base) * step / 8;
+        object.collapseTo(complexity);
+        instance.collapseTo(complexity);
+        vector<Triangle> drawn, expected;
+        vector<int> faces = object.visibleFaces();
+        const vector<vec3>& p = object.vertexPositions();
+        const vector<int>& t = object.triangleIndices();
+        for (int i = 0; i < (int)faces.size(); i++) addTriangle(expected, p[t[3 * faces[i]]], p[t[3 * faces[i] + 1]], p[t[3 * faces[i] + 2]]);
+        const vector<int>& v = instance.indices();
+        for (int f = 0; f < mesh->nFacesAt(instance.collapseIndex()); f++) addTriangle(drawn, mesh->position(v[3 * f]), mesh->position(v[3 * f + 1]), mesh->position(v[3 * f + 2]));
+        sort(drawn.begin(), drawn.end());
+        sort(expected.begin(), expected.end());
+        if (drawn != expected) {
+            printf("checkInstance: at %i vertices the instance draws %i faces, the MeshObject %i, and they differ\n", complexity, (int)drawn.size(), (int)expected.size());
+            return false;
+        }
+    }
+    printf("checkInstance: %i vertices, %i faces match from %i to %i vertices\n", (int)positions.size(), (int)indices.size() / 3, base, full);
+    return true;
+}
+bool Scene::checkClusterDAG(const vector<vec3>& positions, const vector<int>& indices) {
+    ClusterDAG dag;
+    dag.build(positions, indices);
+    auto undirectedEdges = [](const vector<int>& triangles) { // sorted, one entry per face side
+        vector<pair<int, int>> edges;
+        edges.reserve(triangles.size());
+        for (int i = 0; i < (int)triangles.size(); i++) {
+            int a = triangles[i], b = triangles[i - i % 3 + (i + 1) % 3];
+            edges.push_back(pair<int, int>(fmin(a, b), fmax(a, b)));
+        }
+        sort(edges.begin(), edges.end());
+        return edges;
+    };
+    vector<pair<int, int>> sourceEdges = undirectedEdges(indices), border;
+    for (int i = 0; i < (int)sourceEdges.size(); i++) {
+        bool single = (i == 0 || sourceEdges[i - 1] != sourceEdges[i]) && (i + 1 == (int)sourceEdges.size() || sourceEdges[i + 1] != sourceEdges[i]);
+        if (single == true) border.push_back(sourceEdges[i]);
+    }
+    vec3 lo(INFINITY, INFINITY, INFINITY), hi = -lo;
+    for (int v = 0; v < (int)positions.size(); v++) {
+        lo = min(lo, positions[v]);
+        hi = max(hi, positions[v]);
+    }
+    float radius = 0.5f * length(hi - lo);
+    mat4 projection = perspective(radians(45.0f), 1.0f, 0.01f * radius, 10000.0f * radius);
+    vec4 viewport(0, 0, 1024, 1024);
+    int nLevelsSeen = 0;
+    for (float distance : { 1.5f, 3.0f, 10.0f, 30.0f, 100.0f, 1000.0f }) { // in radii. the near ones mix levels across the mesh
+        mat4 modelView = translate(mat4(), vec3(0, 0, -distance * radius)) * translate(mat4(), -0.5f * (lo + hi));
+        vector<int> cut = dag.selectCut(modelView, projection, viewport, 1.0f);
+        int minLevel = dag.nLevels(), maxLevel = -1;
+        for (int i = 0; i < (int)cut.size(); i++) {
+            minLevel = fmin(minLevel, dag.cluster(cut[i])._level);
+            maxLevel = fmax(maxLevel, dag.cluster(cut[i])._level);
+        }
+        nLevelsSeen = fmax(nLevelsSeen, maxLevel - minLevel + 1);
+        vector<pair<int, int>> edges = undirectedEdges(dag.cutIndices(cut));
+        if (edges.empty() == true) {
+            printf("checkClusterDAG: the cut at %g radii is empty\n", distance);
+            return false;
+        }
+        for (int i = 0; i < (int)edges.size();) {
+            int n = 1;
+            while (i + n < (int)edges.size() && edges[i + n] == edges[i]) n++;
+            if (n != 2 && (n != 1 || binary_search(border.begin(), border.end(), edges[i]) == false)) {
+                printf("checkClusterDAG: edge %i %i has %i faces in the cut at %g radii, levels %i to %i\n", edges[i].first, edges[i].second, n, distance, minLevel, maxLevel);
+                return false;
+            }
+            i += n;
+        }
+    }
+    printf("checkClusterDAG: %i faces, %i clusters in %i levels. every cut closed, up to %i levels in one\n", (int)indices.size() / 3, dag.nClusters(), dag.nLevels(), nLevelsSeen);
+    return true;
+}
+void Scene::benchmarkSeek(MeshObject* mesh, vector<pair<string, double>>& times) {
+    typedef chrono::high_resolution_clock Clock;
+    auto ms = [](Clock::time_point start) { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+    float base = mesh->nVerticesCollapsed(), full = mesh->nVertices();
+    size_t snapshotBytes = sizeof(int) * 3 * mesh->nFaces() + 2 * sizeof(vec3) * mesh->nVertices(); // what _buildCheckpoints charges per checkpoint
+    for (int nCheckpoints : { 0, 8, 64 }) { // the longest jump, and the slowest of 32 random far jumps, which land between checkpoints
+        string suffix = ", " + to_string(nCheckpoints) + " checkpoints";
+        auto start = Clock::now();
+        mesh->setCheckpointBudget(nCheckpoints * snapshotBytes + snapshotBytes / 2);
+        if (nCheckpoints > 0) times.push_back(make_pair("setCheckpointBudget" + suffix, ms(start)));
+        mesh->collapseTo(full);
+        start = Clock::now();
+        mesh->collapseTo(base);
+        mesh->collapseTo(full);
+        times.push_back(make_pair("collapseTo seek full-base-full" + suffix, ms(start)));
+        mt19937 random(3);
+        uniform_real_distribution<float> quarter(0, 0.25f);
+        double worst = 0;
+        for (int i = 0; i < 32; i++) {
+            float target = i % 2 == 0 ? base + (full - base) * quarter(random) : full - (full - base) * quarter(random);
+            start = Clock::now();
+            mesh->collapseTo(target);
+            worst = fmax(worst, ms(start));
+        }
+        times.push_back(make_pair("collapseTo seek worst of 32" + suffix, worst));
+        mesh->collapseTo(base);
+    }
+}
+void Scene::benchmarkPipeline(const vector<int>& sizes, const string& jsonFileName) {
+    typedef chrono::high_resolution_clock Clock;
+    auto ms = [](Clock::time_point start) { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+    typedef void(*Generator)(const int&, vector<vec3>&, vector<int>&);
+    const char * names[3] = { "icosphere", "terrain", "torusknot" };
+    Generator generators[3] = { makeIcosphere, makeTerrain, makeTorusKnot };
+    ofstream json(jsonFileName);
+    json << "[\n";
+    bool first = true;
+    for (int g = 0; g < 3; g++) {
+        for (int s = 0; s < (int)sizes.size(); s++) {
+            vector<vec3> positions;
+            vector<int> indices;
+            generators[g](sizes[s], positions, indices);
+            string fileName = string("benchmark_") + names[g] + "_" + to_string(sizes[s]) + ".off";
+            MeshObject::writeOFF(fileName, positions, indices);
+            int nVertices = positions.size(), nFaces = indices.size() / 3;
+            positions.clear();
+            indices.clear();
+            vector<pair<string, double>> times;
+
+            MeshObject* mesh = new MeshObject(fileName);
+            auto start = Clock::now();
+            mesh->readGeom(false); // the parse alone. the next three are timed on their own
+            times.push_back(make_pair("readGeomOFF", ms(start)));
+            start = Clock::now();
+            mesh->reComputeVertexNormals();
+            times.push_back(make_pair("reComputeVertexNormals", ms(start)));
+            start = Clock::now();
+            mesh->reComputeQuadrics();
+            times.push_back(make_pair("reComputeQuadrics", ms(start)));
+            start = Clock::now();
+            mesh->resetPairs();
+            times.push_back(make_pair("setT(0)", ms(start)));
+            mesh->setVerbose(false);
+            int nFull = mesh->nVertices();
+            start = Clock::now();
+            for (int percent : { 10, 50, 90, 100 }) { // one pass, timed as it passes each fraction of the vertices
+                while (mesh->nActiveVertices() > (100 - percent) / 100.0 * nFull) {
+                    if (mesh->quadricSimplify() == false) break;
+                }
+                times.push_back(make_pair("quadricSimplify " + to_string(percent) + "%", ms(start)));
+            }
+            start = Clock::now();
+            mesh->makeProgressiveMeshFile();
+            times.push_back(make_pair("makeProgressiveMeshFile", ms(start)));
+            string pmFileName = mesh->outFileName();
+            delete mesh;
+
+            mesh = new MeshObject(pmFileName);
+            start = Clock::now();
+            mesh->readGeom();
+            times.push_back(make_pair("readGeomOFFPM", ms(start)));
+            float base = mesh->nVerticesCollapsed(), full = mesh->nVertices();
+            start = Clock::now();
+            for (int i = 1; i <= 16; i++) mesh->collapseTo(base + (full - base) * i / 16);
+            times.push_back(make_pair("collapseTo up", ms(start)));
+            start = Clock::now();
+            for (int i = 15; i >= 0; i--) mesh->collapseTo(base + (full - base) * i / 16);
+            times.push_back(make_pair("collapseTo down", ms(start)));
+            benchmarkSeek(mesh, times);
+            delete mesh;
+            remove(fileName.c_str());
+            remove(pmFileName.c_str());
+
+            printf("Pipeline benchmark, %s with %i faces\n", names[g], nFaces);
+            for (int i = 0; i < (int)times.size(); i++) {
+                printf("  %s %.2f ms\n", times[i].first.c_str(), times[i].second);
+                json << (first == true ? "" : ",\n") << "  { \"mesh\": \"" << names[g] << "\", \"vertices\": " << nVertices << ", \"faces\": " << nFaces
+                    << ", \"case\": \"" << times[i].first << "\", \"ms\": " << times[i].second << " }";
+                first = false;
+            }
+            json.flush(); // whatever finished survives a crash on a bigger size
+        }
+    }
+    json << "\n]\n";
+    printf("Pipeline benchmark written to %s\n", jsonFileName.c_str());
+}
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006). Greedily emits the triangle whose vertices score best, where a
+// vertex scores for sitting near the front of a simulated LRU cache and for having few triangles left to emit.
+namespace {
+const int FORSYTH_CACHE_SIZE = 32;
+float forsythScore(const int& cachePosition, const int& nTrianglesLeft) {
+    if (nTrianglesLeft == 0) return -1;
+    float score = 0;
+    if (cachePosition < 0) score = 0;
+    else if (cachePosition < 3) score = 0.75f; // the triangle just emitted. deliberately lower so we don't zig-zag
+    else score = pow(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+    return score + 2.0f / sqrt((float)nTrianglesLeft); // valence boost, so lone triangles get cleared up early
+}
+}
+void Scene::optimizeVertexCache(vector<int>& indices, const int& nVertices) {
+    int nT = indices.size() / 3;
+    if (nT == 0) return;
+    vector<int> nLeft(nVertices, 0); // triangles not yet emitted, per vertex. they are the first nLeft entries of the vertex's list
+    for (int i = 0; i < (int)indices.size(); i++) nLeft[indices[i]]++;
+    vector<int> offset(nVertices + 1, 0);
+    for (int v = 0; v < nVertices; v++) offset[v + 1] = offset[v] + nLeft[v];
+    vector<int> vTriangles(indices.size());
+    vector<int> fill(offset.begin(), offset.end() - 1);
+    for (int i = 0; i < (int)indices.size(); i++) vTriangles[fill[indices[i]]++] = i / 3;
+    vector<int> cachePosition(nVertices, -1);
+    vector<float> vScore(nVertices);
+    for (int v = 0; v < nVertices; v++) vScore[v] = forsythScore(-1, nLeft[v]);
+    vector<float> tScore(nT, 0);
+    for (int t = 0; t < nT; t++) {
+        for (int k = 0; k < 3; k++) tScore[t] += vScore[indices[3 * t + k]];
+    }
+    vector<bool> emitted(nT, false);
+    vector<int> out;
+    out.reserve(indices.size());
+    vector<int> cache, newCache;
+    int best = max_element(tScore.begin(), tScore.end()) - tScore.begin();
+    int nextUnemitted = 0; // dead end fallback
+    while (best >= 0) {
+        emitted[best] = true;
+        int corners[3] = { indices[3 * best + 0], indices[3 * best + 1], indices[3 * best + 2] };
+        newCache.clear();
+        for (int k = 0; k < 3; k++) {
+            int v = corners[k];
+            out.push_back(v);
+            if (find(newCache.begin(), newCache.end(), v) != newCache.end()) continue; // degenerate corner
+            newCache.push_back(v);
+            int* first = vTriangles.data() + offset[v];
+            int* last = first + nLeft[v];
+            swap(*find(first, last, best), *(last - 1)); // drop best from the triangles left to emit
+            nLeft[v]--;
+        }
+        for (int i = 0; i < (int)cache.size(); i++) {
+            if (cache[i] != corners[0] && cache[i] != corners[1] && cache[i] != corners[2]) newCache.push_back(cache[i]);
+        }
+        // rescore everything that moved in or fell out of the cache, then pick the best triangle around the cache
+        best = -1;
+        float bestScore = -1;
+        for (int i = 0; i < (int)newCache.size(); i++) {
+            int v = newCache[i];
+            cachePosition[v] = (i < FORSYTH_CACHE_SIZE) ? i : -1;
+            float score = forsythScore(cachePosition[v], nLeft[v]);
+            float dScore = score - vScore[v];
+            vScore[v] = score;
+            for (int j = offset[v]; j < offset[v] + nLeft[v]; j++) {
+                int t = vTriangles[j];
+                tScore[t] += dScore;
+                if (emitted[t] == true) continue; // a triangle with a repeated corner is listed twice there, and only one entry was dropped
+                if (tScore[t] > bestScore) { best = t; bestScore = tScore[t]; }
+            }
+        }
+        if (newCache.size() > FORSYTH_CACHE_SIZE) newCache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(newCache);
+        if (best >= 0) continue;
+        while (nextUnemitted < nT && emitted[nextUnemitted] == true) nextUnemitted++;
+        if (nextUnemitted < nT) best = nextUnemitted;
+    }
+    assert(out.size() == indices.size()); // every triangle exactly once
+    indices.swap(out);
+}
+vector<int> Scene::optimizeVertexFetch(vector<int>& indices, const int& nVertices) {
+    vector<int> remap(nVertices, -1); // vertices that no triangle uses stay -1
+    int nUsed = 0;
+    for (int i = 0; i < (int)indices.size(); i++) {
+        if (remap[indices[i]] == -1) remap[indices[i]] = nUsed++;
+        indices[i] = remap[indices[i]];
+    }
+    return remap;
+}
+pair<float, float> Scene::vertexCacheStats(const vector<int>& indices, const int& cacheSize) {
+    if (indices.size() == 0) return pair<float, float>(0, 0);
+    deque<int> cache;
+    set<int> unique;
+    int misses = 0;
+    for (int i = 0; i < (int)indices.size(); i++) {
+        unique.insert(indices[i]);
+        if (find(cache.begin(), cache.end(), indices[i]) != cache.end()) continue;
+        misses++;
+        cache.push_back(indices[i]);
+        if ((int)cache.size() > cacheSize) cache.pop_front();
+    }
+    return pair<float, float>((float)misses / (indices.size() / 3), (float)misses / unique.size());
+}
+void DirtyRanges::add(const int& begin, const int& end) {
+    if (end <= begin) return;
+    if (_spans.empty() == false && begin <= _spans.back().second && end >= _spans.back().first) { // touches the last one, as runs of faces do
+        _spans.back().first = fmin(_spans.back().first, begin);
+        _spans.back().second = fmax(_spans.back().second, end);
+        return;
+    }
+    _spans.push_back(pair<int, int>(begin, end));
+    if (_spans.size() > 16 * DIRTY_MAX_SPANS) _merge(); // a long collapseTo marks scattered elements by the thousand
+}
+const vector<pair<int, int>>& DirtyRanges::spans() {
+    _merge();
+    return _spans;
+}
+int DirtyRanges::nElements() {
+    _merge();
+    int n = 0;
+    for (int i = 0; i < (int)_spans.size(); i++) n += _spans[i].second - _spans[i].first;
+    return n;
+}
+void DirtyRanges::_merge() {
+    if (_spans.size() < 2) return;
+    sort(_spans.begin(), _spans.end());
+    int n = 0;
+    for (int i = 1; i < (int)_spans.size(); i++) { // join the ones that overlap or touch
+        if (_spans[i].first <= _spans[n].second) _spans[n].second = fmax(_spans[n].second, _spans[i].second);
+        else _spans[++n] = _spans[i];
+    }
+    _spans.resize(n + 1);
+    if (_spans.size() <= DIRTY_MAX_SPANS) return;
+    vector<int> gaps(_spans.size() - 1); // too many calls. bridge every gap up to the largest DIRTY_MAX_SPANS - 1 left open
+    for (int i = 0; i < (int)gaps.size(); i++) gaps[i] = _spans[i + 1].first - _spans[i].second;
+    nth_element(gaps.begin(), gaps.end() - (DIRTY_MAX_SPANS - 1), gaps.end());
+    int minGap = gaps[gaps.size() - (DIRTY_MAX_SPANS - 1)];
+    int nOpen = DIRTY_MAX_SPANS - 1; // ties with minGap could leave too many open otherwise
+    n = 0;
+    for (int i = 1; i < (int)_spans.size(); i++) {
+        if (_spans[i].first - _spans[n].second < minGap || nOpen == 0) _spans[n].second = _spans[i].second;
+        else {
+            _spans[++n] = _spans[i];
+            nOpen--;
+        }
+    }
+    _spans.resize(n + 1);
+}
+i16vec4 Scene::quantizePosition(const vec3& p, const vec3& center, const float& step) {
+    vec3 q = clamp(round((p - center) / step), -32767.0f, 32767.0f);
+    return i16vec4(q[0], q[1], q[2], 0);
+}
+vec3 Scene::dequantizePosition(const i16vec4& q, const vec3& center, const float& step) {
+    return center + step * vec3(q[0], q[1], q[2]);
+}
+i8vec4 Scene::packNormal(const vec3& n) {
+    vec3 q = clamp(round(127.0f * n), -127.0f, 127.0f);
+    return i8vec4(q[0], q[1], q[2], 0);
+}
+u8vec4 Scene::packColor(const vec4& c) {
+    vec4 q = clamp(round(255.0f * c), 0.0f, 255.0f);
+    return u8vec4(q[0], q[1], q[2], q[3]);
+}
+
+namespace {
+float pointTriangleDistance(const vec3& p, const vec3& a, const vec3& b, const vec3& c) { // Ericson, Real-Time Collision Detection 5.1.5
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) return distance(p, a);
+    vec3 bp = p - b;
+    float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) return distance(p, b);
+    float vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return distance(p, a + ab*(d1 / (d1 - d3)));
+    vec3 cp = p - c;
+    float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) return distance(p, c);
+    float vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return distance(p, a + ac*(d2 / (d2 - d6)));
+    float va = d3*d6 - d5*d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) return distance(p, b + (c - b)*((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    float denom = va + vb + vc;
+    if (denom == 0) return distance(p, a); // degenerate triangle
+    return distance(p, a + ab*(vb / denom) + ac*(vc / denom));
+}
+long long edgeKey(const int& u, const int& v, const int& nVertices) { return (long long)fmin(u, v) * nVertices + (long long)fmax(u, v); }
+struct GroupResult { // what a worker hands back for one group
+    bool _simplified; // false if the locked border left too little to collapse. the children are carried to the next level
+    std::vector<int> _indices; // vertices that kept their position keep their index, moved ones are -(k+1) for _newPositions[k]
+    std::vector<glm::vec3> _newPositions;
+    float _displacement; // farthest any input vertex is from the simplified surface
+};
+}
+void ClusterDAG::build(MeshObject* mesh) {
+    vector<int> visFaceIndices = mesh->visibleFaces();
+    vector<int> indices(3 * visFaceIndices.size());
+    for (int i = 0; i < (int)visFaceIndices.size(); i++) {
+        vector<int> corners = mesh->faces(visFaceIndices[i]);
+        for (int k = 0; k < 3; k++) indices[3 * i + k] = corners[k];
+    }
+    build(mesh->vertexPositions(), indices);
+}
+void ClusterDAG::build(const vector<vec3>& positions, const vector<int>& indices) {
+    _positions = positions;
+    _clusters.clear();
+    _groups.clear();
+    vector<int> level;
+    vector<vector<int>> parts = _partition(indices);
+    for (int i = 0; i < (int)parts.size(); i++) level.push_back(_addCluster(parts[i], 0, -1));
+    _nLevels = 1;
+    printf("Cluster DAG level 0: %i clusters\n", (int)level.size());
+    while (level.size() > 1) {
+        vector<vector<int>> groups = _makeGroups(level);
+        // lock every vertex that another group also uses, and the open border of the mesh, so the groups still meet after simplifying
+        vector<int> vGroup(_positions.size(), -1);
+        vector<bool> locked(_positions.size(), false);
+        unordered_map<long long, int> edgeCount;
+        for (int g = 0; g < (int)groups.size(); g++) {
+            for (int j = 0; j < (int)groups[g].size(); j++) {
+                const vector<int>& ind = _clusters[groups[g][j]]._indices;
+                for (int i = 0; i < (int)ind.size(); i++) {
+                    if (vGroup[ind[i]] == -1) vGroup[ind[i]] = g;
+                    else if (vGroup[ind[i]] != g) locked[ind[i]] = true;
+                    edgeCount[edgeKey(ind[i], ind[i - i % 3 + (i + 1) % 3], _positions.size())]++;
+                }
+            }
+        }
+        for (unordered_map<long long, int>::iterator e = edgeCount.begin(); e != edgeCount.end(); e++) {
+            if (e->second != 1) continue;
+            locked[e->first / _positions.size()] = true;
+            locked[e->first % _positions.size()] = true;
+        }
+        // simplify every group to half its triangles
+        vector<GroupResult> results(groups.size());
+        atomic<int> nextGroup(0);
+        auto work = [&]() {
+            for (int g = nextGroup++; g < (int)groups.size(); g = nextGroup++) {
+                vector<int> globalOf;
+                vector<vec3> localPositions;
+                vector<int> localIndices;
+                unordered_map<int, int> localOf;
+                for (int j = 0; j < (int)groups[g].size(); j++) {
+                    const vector<int>& ind = _clusters[groups[g][j]]._indices;
+                    for (int i = 0; i < (int)ind.size(); i++) {
+                        unordered_map<int, int>::iterator it = localOf.find(ind[i]);
+                        if (it == localOf.end()) {
+                            it = localOf.insert(pair<int, int>(ind[i], globalOf.size())).first;
+                            globalOf.push_back(ind[i]);
+                            localPositions.push_back(_positions[ind[i]]);
+                        }
+                        localIndices.push_back(it->second);
+                    }
+                }
+                MeshObject* m = new MeshObject(""); // Object IDs come from an atomic counter, so each worker makes its own
+                m->setGeom(localPositions, localIndices);
+                m->setGuardTopology(true); // the group has to stay a manifold patch, or the next level's cut cracks
+                for (int l = 0; l < (int)globalOf.size(); l++) {
+                    if (locked[globalOf[l]] == true) m->lockVertex(l);
+                }
+                int nF = localIndices.size() / 3;
+                while (m->nVisibleFaces() > nF / 2) {
+                    if (m->quadricSimplify() == false) break;
+                }
+                GroupResult& result = results[g];
+                vector<int> visFaceIndices = m->visibleFaces();
+                result._simplified = visFaceIndices.size() < 0.85f * nF;
+                if (result._simplified == true) {
+                    const vector<vec3>& simplified = m->vertexPositions();
+                    vector<int> newOf(globalOf.size(), 0);
+                    for (int i = 0; i < (int)visFaceIndices.size(); i++) {
+                        vector<int> corners = m->faces(visFaceIndices[i]);
+                        for (int k = 0; k < 3; k++) {
+                            int l = corners[k];
+                            if (simplified[l] == localPositions[l]) result._indices.push_back(globalOf[l]);
+                            else {
+                                if (newOf[l] == 0) {
+                                    result._newPositions.push_back(simplified[l]);
+                                    newOf[l] = -(int)result._newPositions.size();
+                                }
+                                result._indices.push_back(newOf[l]);
+                            }
+                        }
+                    }
+                    result._displacement = 0;
+                    for (int l = 0; l < (int)localPositions.size(); l++) {
+                        float d = INFINITY;
+                        for (int i = 0; i < (int)visFaceIndices.size(); i++) {
+                            vector<int> corners = m->faces(visFaceIndices[i]);
+                            d = fmin(d, pointTriangleDistance(localPositions[l], simplified[corners[0]], simplified[corners[1]], simplified[corners[2]]));
+                        }
+                        if (d < INFINITY) result._displacement = fmax(result._displacement, d);
+                    }
+                }
+                delete m;
+            }
+        };
+        vector<thread> threads;
+        for (int t = 1; t < fmin(_nThreads, groups.size()); t++) threads.push_back(thread(work));
+        work();
+        for (int t = 0; t < (int)threads.size(); t++) threads[t].join();
+        // stitch the results into the DAG. groups that didn't simplify pass their clusters on to be regrouped
+        vector<int> nextLevel;
+        int nSimplified = 0;
+        for (int g = 0; g < (int)groups.size(); g++) {
+            GroupResult& result = results[g];
+            if (result._simplified == false) {
+                nextLevel.insert(nextLevel.end(), groups[g].begin(), groups[g].end());
+                continue;
+            }
+            nSimplified++;
+            int gi = _groups.size();
+            ClusterGroup group;
+            group._children = groups[g];
+            group._center = _clusters[groups[g][0]]._center;
+            group._radius = _clusters[groups[g][0]]._radius;
+            float childError = 0;
+            for (int j = 0; j < (int)groups[g].size(); j++) { // grow the sphere to hold every child's sphere
+                const Cluster& child = _clusters[groups[g][j]];
+                childError = fmax(childError, child._error);
+                float d = distance(group._center, child._center);
+                if (d + child._radius <= group._radius) continue;
+                float radius = (group._radius + d + child._radius) / 2.0f;
+                if (d > 0) group._center += (child._center - group._center) * ((radius - group._radius) / d);
+                group._radius = radius;
+            }
+            group._error = childError + result._displacement; // never less than a child's, so cuts stay consistent
+            int base = _positions.size();
+            _positions.insert(_positions.end(), result._newPositions.begin(), result._newPositions.end());
+            for (int i = 0; i < (int)result._indices.size(); i++) {
+                if (result._indices[i] < 0) result._indices[i] = base - result._indices[i] - 1;
+            }
+            for (int j = 0; j < (int)groups[g].size(); j++) {
+                Cluster& child = _clusters[groups[g][j]];
+                child._parentCenter = group._center;
+                child._parentRadius = group._radius;
+                child._parentError = group._error;
+                child._parentGroup = gi;
+            }
+            parts = _partition(result._indices);
+            for (int i = 0; i < (int)parts.size(); i++) {
+                int c = _addCluster(parts[i], _nLevels, gi);
+                _clusters[c]._center = group._center;
+                _clusters[c]._radius = group._radius;
+                _clusters[c]._error = group._error;
+                group._parents.push_back(c);
+                nextLevel.push_back(c);
+            }
+            _groups.push_back(group);
+        }
+        if (nSimplified == 0) break;
+        printf("Cluster DAG level %i: %i clusters from %i groups\n", _nLevels, (int)nextLevel.size(), nSimplified);
+        level.swap(nextLevel);
+        _nLevels++;
+    }
+}
+vector<vector<int>> ClusterDAG::_partition(const vector<int>& indices) {
+    int nT = indices.size() / 3;
+    vector<pair<long long, int>> edges; // (edge, triangle), sorted so triangles sharing an edge sit together
+    edges.reserve(indices.size());
+    for (int i = 0; i < (int)indices.size(); i++) edges.push_back(pair<long long, int>(edgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3], _positions.size()), i / 3));
+    sort(edges.begin(), edges.end());
+    vector<vector<int>> neighbors(nT);
+    for (int i = 0, j = 0; i < (int)edges.size(); i = j) {
+        for (j = i; j < (int)edges.size() && edges[j].first == edges[i].first; j++);
+        for (int a = i; a < j; a++) {
+            for (int b = i; b < j; b++) if (a != b) neighbors[edges[a].second].push_back(edges[b].second);
+        }
+    }
+    // breadth-first growth keeps clusters round. the next cluster starts on the frontier the last one left behind
+    vector<int> clusterOf(nT, -1);
+    vector<int> sizes;
+    deque<int> frontier;
+    int seed = 0;
+    while (true) {
+        int start = -1;
+        while (!frontier.empty() && start == -1) {
+            if (clusterOf[frontier.front()] == -1) start = frontier.front();
+            frontier.pop_front();
+        }
+        if (start == -1) {
+            while (seed < nT && clusterOf[seed] != -1) seed++;
+            if (seed == nT) break;
+            start = seed;
+        }
+        int size = 0;
+        deque<int> queue(1, start);
+        while (!queue.empty() && size < _clusterSize) {
+            int t = queue.front();
+            queue.pop_front();
+            if (clusterOf[t] != -1) continue;
+            clusterOf[t] = sizes.size();
+            size++;
+            for (int n = 0; n < (int)neighbors[t].size(); n++) {
+                if (clusterOf[neighbors[t][n]] == -1) queue.push_back(neighbors[t][n]);
+            }
+        }
+        frontier.swap(queue);
+        sizes.push_back(size);
+    }
+    // growth leaves slivers wedged between full clusters. fold them into their smallest neighbor, they would only make tiny groups later
+    vector<int> mergedInto(sizes.size());
+    for (int c = 0; c < (int)sizes.size(); c++) mergedInto[c] = c;
+    vector<vector<int>> members(sizes.size());
+    for (int t = 0; t < nT; t++) members[clusterOf[t]].push_back(t);
+    for (int c = 0; c < (int)sizes.size(); c++) {
+        if (sizes[c] >= _clusterSize / 4) continue;
+        int target = -1;
+        for (int i = 0; i < (int)members[c].size(); i++) {
+            int t = members[c][i];
+            for (int n = 0; n < (int)neighbors[t].size(); n++) {
+                int d = clusterOf[neighbors[t][n]];
+                while (mergedInto[d] != d) d = mergedInto[d];
+                if (d == c) continue;
+                if (target == -1 || sizes[d] < sizes[target]) target = d;
+            }
+        }
+        if (target == -1) continue; // an island
+        mergedInto[c] = target;
+        sizes[target] += sizes[c];
+    }
+    vector<int> slot(sizes.size(), -1);
+    vector<vector<int>> clusters;
+    for (int t = 0; t < nT; t++) {
+        int c = clusterOf[t];
+        while (mergedInto[c] != c) c = mergedInto[c];
+        if (slot[c] == -1) {
+            slot[c] = clusters.size();
+            clusters.push_back(vector<int>());
+        }
+        for (int k = 0; k < 3; k++) clusters[slot[c]].push_back(indices[3 * t + k]);
+    }
+    return clusters;
+}
+vector<vector<int>> ClusterDAG::_makeGroups(const vector<int>& level) {
+    vector<map<int, int>> shared(level.size()); // shared[a][b]: border edges between clusters level[a] and level[b]
+    unordered_map<long long, int> owner;
+    for (int a = 0; a < (int)level.size(); a++) {
+        const vector<int>& ind = _clusters[level[a]]._indices;
+        for (int i = 0; i < (int)ind.size(); i++) {
+            long long key = edgeKey(ind[i], ind[i - i % 3 + (i + 1) % 3], _positions.size());
+            unordered_map<long long, int>::iterator it = owner.find(key);
+            if (it == owner.end()) owner[key] = a;
+            else if (it->second != a) {
+                shared[a][it->second]++;
+                shared[it->second][a]++;
+            }
+        }
+    }
+    vector<bool> grouped(level.size(), false);
+    vector<vector<int>> groups;
+    for (int a = 0; a < (int)level.size(); a++) {
+        if (grouped[a] == true) continue;
+        vector<int> group(1, a);
+        grouped[a] = true;
+        map<int, int> candidates = shared[a]; // ungrouped neighbors and how many edges they share with the group so far
+        int nTriangles = _clusters[level[a]]._indices.size() / 3;
+        while (nTriangles < _groupSize * _clusterSize) { // count triangles, not clusters, so leftover small clusters get absorbed
+            int best = -1;
+            for (map<int, int>::iterator it = candidates.begin(); it != candidates.end(); it++) {
+                if (grouped[it->first] == true) continue;
+                if (best == -1 || it->second > candidates[best]) best = it->first;
+            }
+            if (best == -1) break;
+            group.push_back(best);
+            grouped[best] = true;
+            nTriangles += _clusters[level[best]]._indices.size() / 3;
+            for (map<int, int>::iterator it = shared[best].begin(); it != shared[best].end(); it++) candidates[it->first] += it->second;
+        }
+        for (int j = 0; j < (int)group.size(); j++) group[j] = level[group[j]];
+        groups.push_back(group);
+    }
+    return groups;
+}
+int ClusterDAG::_addCluster(const vector<int>& indices, const int& level, const int& group) {
+    Cluster cluster;
+    cluster._indices = indices;
+    vec3 lo = _positions[indices[0]], hi = _positions[indices[0]];
+    for (int i = 1; i < (int)indices.size(); i++) {
+        lo = min(lo, _positions[indices[i]]);
+        hi = max(hi, _positions[indices[i]]);
+    }
+    cluster._center = (lo + hi) / 2.0f;
+    cluster._radius = 0;
+    for (int i = 0; i < (int)indices.size(); i++) cluster._radius = fmax(cluster._radius, distance(cluster._center, _positions[indices[i]]));
+    cluster._error = 0;
+    cluster._parentCenter = cluster._center;
+    cluster._parentRadius = cluster._radius;
+    cluster._parentError = INFINITY;
+    cluster._level = level;
+    cluster._group = group;
+    cluster._parentGroup = -1;
+    _clusters.push_back(cluster);
+    return _clusters.size() - 1;
+}
+float ClusterDAG::_projectedError(const float& error, const vec3& center, const float& radius, const mat4& modelView, const float& kappa) {
+    if (error == 0) return 0;
+    if (error == INFINITY) return INFINITY;
+    float z = -(modelView * vec4(center, 1))[2];
+    if (z <= radius) return INFINITY; // the eye is inside the bounds
+    return error * kappa / (z - radius);
+}
+vector<int> ClusterDAG::selectCut(const mat4& modelView, const mat4& projection, const vec4& viewport, const float& pixelTolerance) {
+    // draw a cluster when it is detailed enough but the group it was simplified in is not. both tests are shared group-wide and
+    // the parent's bounds hold the child's, so siblings always switch together and the cut never opens a crack
+    float kappa = pixelsPerUnit(projection, viewport[3]);
+    vector<int> cut;
+    for (int i = 0; i < (int)_clusters.size(); i++) {
+        const Cluster& c = _clusters[i];
+        if (_projectedError(c._error, c._center, c._radius, modelView, kappa) > pixelTolerance) continue;
+        if (_projectedError(c._parentError, c._parentCenter, c._parentRadius, modelView, kappa) <= pixelTolerance) continue;
+        cut.push_back(i);
+    }
+    return cut;
+}
+vector<int> ClusterDAG::cutIndices(const vector<int>& cut) {
+    vector<int> indices;
+    for (int i = 0; i < (int)cut.size(); i++) indices.insert(indices.end(), _clusters[cut[i]]._indices.begin(), _clusters[cut[i]]._indices.end());
+    return indices;
+}
+
+ErrorMeter::ErrorMeter(MeshObject* reference, const int& nSamples) : _nSamples(nSamples), _measureTime(0) {
+    _nThreads = fmax(1, std::thread::hardware_concurrency());
+    reference->finishWindow();
+    vector<int> faces = reference->visibleFaces();
+    const vector<int>& indices = reference->triangleIndices();
+    _positions = reference->vertexPositions();
+    _indices.resize(3 * faces.size());
+    for (int i = 0; i < (int)faces.size(); i++) {
+        for (int k = 0; k < 3; k++) _indices[3 * i + k] = indices[3 * faces[i] + k];
+    }
+    if (faces.empty() == true) printf("The reference surface has no faces, so every measure comes back empty\n");
+    _bvh.build(_positions, _indices);
+    vector<int> all(faces.size());
+    for (int i = 0; i < (int)all.size(); i++) all[i] = i;
+    _sample(_positions, _indices, all, _samples);
+}
+void ErrorMeter::_sample(const vector<vec3>& positions, const vector<int>& indices, const vector<int>& faces, vector<vec3>& samples) {
+    samples.clear();
+    vector<bool> seen(positions.size(), false);
+    for (int i = 0; i < (int)faces.size(); i++) { // the vertices, where the largest errors of a simplified mesh tend to sit
+        for (int k = 0; k < 3; k++) {
+            int v = indices[3 * faces[i] + k];
+            if (seen[v] == true) continue;
+            seen[v] = true;
+            samples.push_back(positions[v]);
+        }
+    }
+    vector<double> area(faces.size() + 1, 0); // running total, to pick faces in proportion to their area
+    for (int i = 0; i < (int)faces.size(); i++) {
+        const int* t = &indices[3 * faces[i]];
+        area[i + 1] = area[i] + 0.5 * length(cross(positions[t[1]] - positions[t[0]], positions[t[2]] - positions[t[0]]));
+    }
+    if (faces.empty() == true || area.back() <= 0) return;
+    mt19937 random(1); // fixed, so two measures of one mesh agree
+    uniform_real_distribution<double> uniform(0, 1);
+    for (int n = 0; n < _nSamples; n++) {
+        int i = upper_bound(area.begin(), area.end(), uniform(random) * area.back()) - area.begin() - 1;
+        i = fmin(fmax(i, 0), faces.size() - 1);
+        float a = uniform(random), b = uniform(random);
+        if (a + b > 1) { // fold the square onto the triangle
+            a = 1 - a;
+            b = 1 - b;
+        }
+        const int* t = &indices[3 * faces[i]];
+        samples.push_back(positions[t[0]] + a * (positions[t[1]] - positions[t[0]]) + b * (positions[t[2]] - positions[t[0]]));
+    }
+}
+void ErrorMeter::_distances(const vector<vec3>& samples, const TriangleBVH& bvh, float& maxDistance, float& rmsDistance) {
+    const int chunk = 1024;
+    int nChunks = (samples.size() + chunk - 1) / chunk;
+    vector<float> chunkMax(nChunks, 0);
+    vector<double> chunkSum(nChunks, 0); // summed per chunk, so the total doesn't depend on the thread count
+    atomic<int> nextChunk(0);
+    auto work = [&]() {
+        for (int c = nextChunk++; c < nChunks; c = nextChunk++) {
+            for (int i = c * chunk; i < fmin((c + 1) * chunk, samples.size()); i++) {
+                SurfacePoint closest;
+                if (bvh.closestPoint(samples[i], closest) == false) continue; // only an empty tree has nothing near, and measure never asks one
+                float d = closest._distance;
+                chunkMax[c] = fmax(chunkMax[c], d);
+                chunkSum[c] += (double)d * d;
+            }
+        }
+    };
+    vector<thread> threads;
+    for (int t = 1; t < fmin(_nThreads, nChunks); t++) threads.push_back(thread(work));
+    work();
+    for (int t = 0; t < (int)threads.size(); t++) threads[t].join();
+    double sum = 0;
+    maxDistance = 0;
+    for (int c = 0; c < nChunks; c++) {
+        maxDistance = fmax(maxDistance, chunkMax[c]);
+        sum += chunkSum[c];
+    }
+    rmsDistance = samples.empty() == true ? 0 : sqrt(sum / samples.size());
+}
+SurfaceError ErrorMeter::measure(MeshObject* mesh) {
+    typedef chrono::high_resolution_clock Clock;
+    auto start = Clock::now();
+    SurfaceError error;
+    mesh->finishWindow(); // mid-morph, the window vertices sit between two LODs
+    vector<int> faces = mesh->visibleFaces();
+    error._nFaces = _indices.empty() == true ? 0 : faces.size(); // nothing to measure against counts as nothing to measure
+    error._maxForward = error._maxBackward = error._rmsForward = error._rmsBackward = 0;
+    if (error.empty() == true) {
+        _measureTime = chrono::duration<double, milli>(Clock::now() - start).count();
+        return error;
+    }
+    vector<vec3> samples;
+    _sample(mesh->vertexPositions(), mesh->triangleIndices(), faces, samples);
+    _distances(samples, _bvh, error._maxForward, error._rmsForward);
+    _distances(_samples, mesh->bvh(), error._maxBackward, error._rmsBackward); // refits the mesh's tree first if it changed
+    _measureTime = chrono::duration<double, milli>(Clock::now() - start).count();
+    return error;
+}
+void ErrorMeter::measureCurve(MeshObject* mesh, const int& nPoints, vector<float>& complexities, vector<SurfaceError>& errors) {
+    complexities.clear();
+    errors.clear();
+    if (mesh->format() != "offpm" || nPoints < 1) return;
+    float complexity = mesh->complexity();
+    float full = mesh->nVertices(), base = mesh->nVerticesCollapsed();
+    for (int i = 0; i < nPoints; i++) {
+        float c = nPoints == 1 ? full : round(full * pow(base / full, i / (float)(nPoints - 1)));
+        if (complexities.empty() == false && c == complexities.back()) continue;
+        mesh->collapseTo(c);
+        complexities.push_back(mesh->complexity());
+        errors.push_back(measure(mesh));
+    }
+    mesh->collapseTo(complexity);
+}
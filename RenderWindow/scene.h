@@ -12,63 +12,247 @@ enum{
     MIDPOINT_APPROXIMATION_METHOD = 1,
     QUADRIC_APPROXIMATION_METHOD = 2
 };
+enum{
+    LOD_BY_VERTEX_FRACTION = 0, // MeshObject::makeLODFiles thresholds are fractions of the full vertex count
+    LOD_BY_QUADRIC_ERROR = 1 // thresholds are the largest quadric error a level may have collapsed
+};
+enum{
+    LOD_IDLE = 0, // MeshObject::setTargetComplexity phases. nothing in flight
+    LOD_MORPHING = 1, // blending the window vertices between their fine and coarse positions
+    LOD_APPLYING = 2 // changing the window topology while every window vertex sits at its coarse position
+};
+enum{
+    DIRTY_MAX_SPANS = 64 // glBufferSubData calls a buffer may take per frame before DirtyRanges bridges gaps
+};
+enum{
+    LOD_BUDGET_STEP = 32 // collapses a World triangle budget moves a mesh by at a time, about 64 triangles
+};
+enum{
+    BVH_LEAF_SIZE = 4, // triangles in a TriangleBVH leaf, one SSE lane each
+    BVH_BINS = 16, // centroid bins the SAH tries split planes between
+    BVH_MAX_DEPTH = 48 // past this a TriangleBVH halves its faces at every level, so no leaf is twice this deep
+};
 
 class Object;
 class Shader;
 class Camera;
+class MeshObject;
+class ProgressiveMesh;
 
-class World
+struct LineVertex {
+    glm::vec3 _position;
+    glm::u8vec4 _color;
+};
+class LineBatch // debug lines gathered over a frame and drawn with one glDrawArrays
 {
 public:
-    World() : _cam(nullptr) {}
+    LineBatch() : _vertexArrayID(0), _bufferID(0), _capacity(0) {}
+    void add(const glm::vec3& a, const glm::vec3& b, const glm::vec4& color);
+    void add(const glm::vec3& a, const glm::vec3& b, const glm::vec4& color, const glm::mat4& transform); // a and b in the coordinates of transform
+    void draw(); // upload, draw and clear
+    void clear() { _vertices.clear(); }
+    int size() { return _vertices.size() / 2; } // lines waiting to be drawn
+
+    ~LineBatch();
+private:
+    std::vector<LineVertex> _vertices;
+    GLuint _vertexArrayID;
+    GLuint _bufferID;
+    size_t _capacity; // vertices the buffer has room for
+};
 
-    void addObject(Object *);
-    void addObject(Camera *);
+struct Frustum // the six planes of a view-projection matrix, normals pointing inside
+{
+    glm::vec4 _planes[6];
+    Frustum(const glm::mat4& viewProjection);
+    bool outside(const glm::vec3& center, const float& radius) const;
+    bool outside(const glm::vec3& lo, const glm::vec3& hi) const; // axis aligned box
+};
+
+void bindVertexArray(const GLuint& vertexArray); // glBindVertexArray, skipped when it is already bound. every bind goes through it, so it knows what is
+void bindElementBuffer(const GLuint& buffer); // for updating an index buffer: unbinds the vertex array first, so the update leaves its binding alone
+float pixelsPerUnit(const glm::mat4& projection, const float& viewportHeight); // screen pixels a unit length at unit depth covers
+int collapseIndexForError(const std::vector<float>& errorCurve, const float& maxError); // the most collapses of a MeshObject::errorCurve whose error stays within maxError
+
+struct DrawItem
+{
+    unsigned long long _key; // shader program, then vertex array, then depth
+    Object * _object;
+    Shader * _shader;
+    bool operator<(const DrawItem& rhs) const { return _key < rhs._key; }
+};
+class RenderQueue // a frame's draws sorted so objects sharing a program and vertex array go out together
+{
+public:
+    RenderQueue() : _nDrawCalls(0), _nStateChanges(0) {}
+    void add(Object * object, Shader * shader, const float& depth); // depth is the view space distance, nearer draws first
+    void submit(); // sort, draw and clear. a program or vertex array is only bound when it differs from the last one
+    void clear() { _items.clear(); }
+    int size() { return _items.size(); }
+    int nDrawCalls() { return _nDrawCalls; } // objects the last submit drew
+    int nStateChanges() { return _nStateChanges; } // program and vertex array switches the last submit needed
+private:
+    std::vector<DrawItem> _items;
+    int _nDrawCalls;
+    int _nStateChanges;
+};
+
+struct ObjectHandle // names an object in a World. goes stale when the object is removed, even once its slot is reused
+{
+    unsigned _index;
+    unsigned _generation;
+    ObjectHandle() : _index(~0u), _generation(0) {}
+    ObjectHandle(unsigned index, unsigned generation) : _index(index), _generation(generation) {}
+    bool operator==(const ObjectHandle& rhs) const { return _index == rhs._index && _generation == rhs._generation; }
+};
+
+struct LODEntry // a drawn progressive mesh while World shares out its triangle budget
+{
+    MeshObject * _mesh;
+    float _scale; // pixels per unit of the mesh's error at its distance
+    int _index; // collapses applied
+    int _start; // _index before the allocation
+    int _version; // moves queued before the last change are stale
+};
+struct LODMove // one step of an entry up or down its progressive mesh
+{
+    float _rate; // screen-space error changed per triangle
+    int _entry;
+    int _version;
+    LODMove(float rate, int entry, int version) : _rate(rate), _entry(entry), _version(version) {}
+    bool operator<(const LODMove& rhs) const { return _rate < rhs._rate; }
+};
+
+struct TransformArrays // translations and angles with an array per component, so composeTransforms takes four objects at a time
+{
+    std::vector<float> _tx, _ty, _tz;
+    std::vector<float> _phi, _the, _psi; // degrees
+    void clear();
+    void push_back(const glm::vec3& translation, const glm::vec3& angles);
+    int size() const { return _tx.size(); }
+};
+
+class World // objects live in dense arrays indexed alike. handles map to them through a slot table
+{
+public:
+    World() : _nDrawn(0), _nCulled(0), _nTransformUpdates(0), _triangleBudget(0), _nBudgetTriangles(0), _cam(nullptr) {}
+
+    ObjectHandle addObject(Object *);
+    ObjectHandle addObject(Camera *);
     void removeObject(Object *);
-    void assignShader(Object *, Shader *);
+    void removeObject(ObjectHandle); // swaps the last object into the hole, so the order of the rest changes
+    Object * get(ObjectHandle); // nullptr once the handle is stale
+    int size() { return _objects.size(); }
+    void assignShader(Object *, Shader *); // may come before addObject
     Shader * findShader(Object *);
 
-    //void removeObject(Object & obj) {  }
-
     Camera * getCam() { return _cam; }
-
-    void draw();
+    LineBatch & lines() { return _lines; } // objects add their lines while drawing, draw() flushes them after the last object
+    int nDrawn() { return _nDrawn; } // objects the last draw() submitted
+    int nCulled() { return _nCulled; } // objects the last draw() skipped for being outside the view frustum
+    RenderQueue & queue() { return _queue; }
+
+    void updateTransforms(); // recompute the matrices, bounds and visibility of every object touched since the last call, in one pass. draw() starts with it
+    int nTransformUpdates() { return _nTransformUpdates; } // matrices the last updateTransforms recomputed
+    void draw(); // culls against the modelview and projection matrices current at the call
+    void setTriangleBudget(const int& nTriangles) { _triangleBudget = nTriangles; } // shared every frame by the drawn .offpm meshes so the total screen-space error is least. 0 turns it off
+    int triangleBudget() { return _triangleBudget; }
+    int nBudgetTriangles() { return _nBudgetTriangles; } // triangles the last allocation gave out
 
     ~World() {};
 private:
+    /* dense, one entry per object, in the same order */
     std::vector<Object *> _objects;
-    std::unordered_map<int, Shader *> _shaderMap;
+    std::vector<Shader *> _shaders;
+    std::vector<char> _visible;
+    std::vector<char> _bounded;
+    std::vector<glm::vec3> _boundsLo, _boundsHi; // world space
+    std::vector<glm::vec3> _boundsCenter;
+    std::vector<float> _boundsRadius;
+    std::vector<glm::vec3> _positions; // depth for objects without bounds
+    std::vector<unsigned> _denseSlot; // slot owning each dense entry, for fixing up a swap-remove
+    std::vector<MeshObject *> _meshes; // nullptr unless the object is a MeshObject
+
+    /* slot table, one entry per handle index ever given out */
+    std::vector<unsigned> _slotDense; // ~0u while the slot is free
+    std::vector<unsigned> _slotGeneration;
+    std::vector<char> _slotTouched;
+    std::vector<unsigned> _freeSlots;
+    std::vector<unsigned> _touched; // slots to refresh in the next updateTransforms
+
+    std::unordered_map<int, Shader *> _shaderMap; // shaders assigned to objects not added yet, by ID
+    LineBatch _lines;
+    RenderQueue _queue;
+    int _nDrawn;
+    int _nCulled;
+    std::vector<unsigned> _moved; // scratch for updateTransforms, kept to avoid reallocating every frame
+    TransformArrays _transforms;
+    std::vector<glm::mat4> _matrices;
+    int _nTransformUpdates;
+    int _triangleBudget;
+    int _nBudgetTriangles;
+    std::vector<LODEntry> _lodEntries; // scratch for _allocateTriangles
 
     Camera * _cam;
+
+    int _dense(ObjectHandle); // -1 if stale
+    void _touch(ObjectHandle); // queue the object's cached state for refreshing
+    void _allocateTriangles(); // greedy over _lodEntries, starting from where every mesh is headed already
+    friend class Object;
 };
 
 World & createWorld();
 
+glm::mat4 composeTransform(const glm::vec3& translation, const glm::vec3& angles); // angles are phi, the, psi in degrees. T * Rz(psi) * Ry(the) * Rz(phi)
+void composeTransforms(const TransformArrays& transforms, std::vector<glm::mat4>& matrices); // the same over whole arrays, four at a time with SSE
+void benchmarkWorld(int nObjects); // time adding, drawing and removing nObjects arrows in a world of their own. needs a GL context
+void benchmarkInstancing(std::shared_ptr<const ProgressiveMesh> mesh, int nInstances); // CPU submit time of nInstances copies in a grid, instanced and one by one. needs a GL context
+void benchmarkSeek(MeshObject* mesh, std::vector<std::pair<std::string, double>>& times); // collapseTo latency with 0, 8 and 64 checkpoints on a .offpm mesh, appended to times in ms. leaves it at the base mesh. no GL needed
+void benchmarkPipeline(const std::vector<int>& sizes, const std::string& jsonFileName); // every generated mesh at every face count through the .off to .offpm pipeline, timings to jsonFileName. no GL needed
+
+// Procedural meshes for benchmarks, sized to about nFaces
+void makeIcosphere(const int& nFaces, std::vector<glm::vec3>& positions, std::vector<int>& indices); // the subdivision level nearest nFaces, 20 * 4^k faces
+void makeTerrain(const int& nFaces, std::vector<glm::vec3>& positions, std::vector<int>& indices); // noisy height field over a square grid, so it has a boundary
+void makeTorusKnot(const int& nFaces, std::vector<glm::vec3>& positions, std::vector<int>& indices); // tube around a (2, 3) torus knot, long and thin
+void makeFan(const int& nFaces, std::vector<glm::vec3>& positions, std::vector<int>& indices); // two cones on one jagged rim, so each apex has nFaces / 2 slivers around it
+
+bool checkSimplify(const std::vector<glm::vec3>& positions, const std::vector<int>& indices); // quadricSimplify with setGuardTopology to completion, checking after every step that the faces stay edge-manifold and none turns over. no GL needed
+bool checkClusterDAG(const std::vector<glm::vec3>& positions, const std::vector<int>& indices); // ClusterDAG cuts from near to far, checking that every edge has two faces or lies on the mesh's border. no GL needed
+bool checkInstance(const std::vector<glm::vec3>& positions, const std::vector<int>& indices); // through a .offpm, checking that a MeshInstance draws the faces a MeshObject does at every eighth of the LODs. no GL needed
+
     /* Base class for vert/frag shader. */
 class Shader
 {
 public:
 /* Constructors */
-    Shader() : _vertfile(), _fragfile(), _shaderReady(false) { };
+    Shader() : _vertfile(), _fragfile(), _program(0), _modelMatrixLocation(-1), _shaderReady(false), _linked(false) { };
     Shader(std::string vertfile, std::string fragfile)
-        : _vertfile(vertfile), _fragfile(fragfile), _shaderReady(false)
+        : _vertfile(vertfile), _fragfile(fragfile), _program(0), _modelMatrixLocation(-1), _shaderReady(false), _linked(false)
         {
             _initShaders();
         };
+    static Shader * fromSource(const std::string& name, const std::string& vertSource, const std::string& fragSource); // for programs the code carries itself
 
     virtual void link();
     virtual void unlink();
     GLuint getProgram() { return _program; };
+    bool linked() { return _linked; } // false if either stage failed to compile or the program failed to link
+    GLint attributeLocation(const char * name) { return glGetAttribLocation(_program, name); }
+    GLint uniformLocation(const char * name) { return glGetUniformLocation(_program, name); }
+    void setModelMatrix(const glm::mat4& model) { if (_modelMatrixLocation != -1) glUniformMatrix4fv(_modelMatrixLocation, 1, GL_FALSE, &model[0][0]); } // needs link() first. ignored by programs without a modelMatrix uniform
 
 /* Destructors */
-    ~Shader() { glDeleteProgram(_program); }
+    virtual ~Shader() { glDeleteProgram(_program); }
 
 private:
     std::string _vertfile, _fragfile;
+    std::string _vertSource, _fragSource; // used instead of the files when set
     GLuint _program;
+    GLint _modelMatrixLocation;
     GLuint _vertex;
     GLuint _frag;
     bool _shaderReady;
+    bool _linked;
 
     void _initShaders();
     bool _checkShaderError(GLuint);
@@ -78,18 +262,24 @@ class Object
 {
 public:
 /* Constructors */
-    Object() : _tx(0), _ty(0), _tz(0), _phi(0), _the(0), _psi(0), _visible(true)
+    Object() : _world(nullptr), _tx(0), _ty(0), _tz(0), _phi(0), _the(0), _psi(0), _visible(true), _transformDirty(true), _boundsDirty(true)
         {
             _objectID = nextID();
         }
-    Object(float tx, float ty, float tz, float phi, float the, float psi) : _tx(tx), _ty(ty), _tz(tz),
-        _phi(psi), _the(the), _psi(psi), _visible(true)
+    Object(float tx, float ty, float tz, float phi, float the, float psi) : _world(nullptr), _tx(tx), _ty(ty), _tz(tz),
+        _phi(psi), _the(the), _psi(psi), _visible(true), _transformDirty(true), _boundsDirty(true)
         {
             _objectID = nextID();
         }
     void draw();
     void draw(Shader *);
     virtual void doDraw() = 0;
+    virtual GLuint vertexArray() { return 0; } // for sorting draws, 0 if the object has none
+    const glm::mat4& modelMatrix(); // the transform draw() applies. cached until a setter moves the object
+    virtual bool localBounds(glm::vec3&, glm::vec3&) { return false; } // box in model coordinates. false if there is nothing to cull by
+    bool worldBounds(glm::vec3& lo, glm::vec3& hi); // box around the transformed localBounds. cached until the transform or bounds change
+    bool worldBounds(glm::vec3& center, float& radius); // bounding sphere of the same
+    void invalidateBounds() { _boundsDirty = true; _touch(); }
 
     /* getters */
     float getTx() { return _tx; } const
@@ -101,31 +291,47 @@ public:
     bool getVisible() { return _visible; } const
     World* getWorld() { return _world; } const
     int getID() { return _objectID; } const
+    ObjectHandle getHandle() const { return _handle; }
 
     /* setters */
-    void setTx(float tx) { _tx = tx; }
-    void setTy(float ty) { _ty = ty; }
-    void setTz(float tz) { _tz = tz; }
-    void setPhi(float phi) { _phi = phi; }
-    void setThe(float the) { _the = the; }
-    void setPsi(float psi) { _psi = psi; }
-    void setVisible(bool visible) { _visible = visible; }
+    void setTx(float tx) { _tx = tx; _moved(); }
+    void setTy(float ty) { _ty = ty; _moved(); }
+    void setTz(float tz) { _tz = tz; _moved(); }
+    void setPhi(float phi) { _phi = phi; _moved(); }
+    void setThe(float the) { _the = the; _moved(); }
+    void setPsi(float psi) { _psi = psi; _moved(); }
+    void setVisible(bool visible) { _visible = visible; _touch(); }
     void setWorld(World * world) { _world = world; }
 
     /* Single line functions */
     int nextID() { return NEXTID++; }
 
-    ~Object() { _world->removeObject(this); }
+    virtual ~Object() { if (_world != nullptr) _world->removeObject(this); }
 
 protected:
+    void _drawLine(const glm::vec3& a, const glm::vec3& b, const glm::vec4& color); // into the world's line batch, or right away without a world
+
     World * _world;
+    ObjectHandle _handle;
     int _objectID;
     float _tx, _ty, _tz;
     float _phi, _the, _psi;
     bool _visible;
+    bool _transformDirty;
+    glm::mat4 _modelMatrix;
+    bool _boundsDirty;
+    bool _bounded; // what localBounds said when the cache was filled
+    glm::vec3 _boundsLo, _boundsHi; // world space
+    glm::vec3 _boundsCenter;
+    float _boundsRadius;
+
+    void _updateBounds();
+    void _moved() { _transformDirty = true; _boundsDirty = true; _touch(); }
+    void _touch() { if (_world != nullptr) _world->_touch(_handle); }
 
 private:
-    static int NEXTID;
+    static std::atomic<int> NEXTID; // Objects are made on worker threads too, by ClusterDAG::build
+    friend class World; // World::updateTransforms fills _modelMatrix for many objects at once, addObject sets _handle
 };
 
 class Camera : public Object
@@ -148,6 +354,11 @@ public:
         _rows(rows), _cols(cols), _gap(gap) { }
 
     void doDraw();
+    bool localBounds(glm::vec3& lo, glm::vec3& hi) {
+        lo = glm::vec3(-(_cols / 2.0f)*_gap, 0, -(_rows / 2.0f)*_gap);
+        hi = -lo;
+        return true;
+    }
 
 private:
     int _rows, _cols;
@@ -160,6 +371,7 @@ public:
     Arrow(const glm::vec3& tail, const glm::vec3& head) : Object(), _tail(tail), _head(head), _color(glm::vec4(1, 1, 1, 1)) {}
     Arrow(const glm::vec3& tail, const glm::vec3& head, const glm::vec4& color) : Object(), _tail(tail), _head(head), _color(color) {}
     void doDraw();
+    bool localBounds(glm::vec3& lo, glm::vec3& hi) { lo = glm::min(_tail, _head); hi = glm::max(_tail, _head); return true; }
 private:
     glm::vec4 _color;
     glm::vec3 _head;
@@ -174,6 +386,7 @@ public:
     Sphere(float radius, int n, int m) : Object(), _r(radius), _n(n), _m(m) { }
 
     void doDraw();
+    bool localBounds(glm::vec3& lo, glm::vec3& hi) { lo = glm::vec3(-_r, -_r, -_r); hi = -lo; return true; }
 
 protected:
     int _n, _m; // number of theta and phi subdivisions respectively
@@ -188,7 +401,7 @@ public:
 
     ~ObjGeometry()
     {
-        glBindVertexArray(0);
+        bindVertexArray(0);
         glDeleteVertexArrays(1, &_vertexArrayID);
     }
 
@@ -265,9 +478,130 @@ struct Edge {
         return false;
     }
 };
+struct Collapse { // one recorded collapse of v1 into v0. Its face indices live in MeshObject::_collapseFaces
+    int _v0;
+    int _v1;
+    glm::vec3 _xyz0; // coordinates of v0 before collapse
+    glm::vec3 _xyz1; // coordinates of v1 before collapse
+    glm::vec3 _xyz;  // coordinates of merge(v0,v1) after collapse (REPLACES xyz0)
+    int _f;   // offset into _collapseFaces, laid out as fVec1 | fVecR | fVecRijk | fVec
+    int _nF;  // faces adjacent to v0 after the collapse (fVec)
+    int _nF1; // faces moved from v1 to v0 (fVec1)
+    int _nFR; // shared faces removed by the collapse (fVecR), each followed later by its 3 corners (fVecRijk)
+    float _error; // quadric error of the pair when it was collapsed, roughly a squared distance. fins removed with it share it. -1 if unknown
+};
+struct Checkpoint { // snapshot of a progressive mesh with collapses [0, _collapseIndex) applied
+    int _collapseIndex;
+    std::vector<int> _triangleIndices;
+    std::vector<glm::vec3> _vertexPositions;
+    std::vector<glm::vec3> _vertexNormals;
+};
+struct CollapseNode { // the region of a progressive mesh that collapse record i coarsens, for view-dependent refinement
+    glm::vec3 _center; // bounding sphere of the region and everything below it in the hierarchy
+    float _radius;
+    glm::vec3 _axis; // normal cone of the region
+    float _coneAngle;
+    float _error; // how far the region moves when collapsed, at least the error of its children
+    int _parent; // the collapse that next merges the vertex made by this one, -1 at the base mesh
+    int _children[2]; // the collapses that made v0 and v1, -1 for vertices of the full mesh
+};
+struct DirtyRanges { // elements of a buffer that changed since it was last uploaded, as sorted disjoint [begin, end) spans
+    std::vector<std::pair<int, int>> _spans; // appended by add, sorted and merged by spans()
+    void clear() { _spans.clear(); }
+    bool empty() const { return _spans.empty(); }
+    void add(const int& begin, const int& end);
+    void add(const int& i) { add(i, i + 1); }
+    const std::vector<std::pair<int, int>>& spans(); // at most DIRTY_MAX_SPANS of them, bridging the smallest clean gaps if there were more
+    int nElements(); // covered by spans()
+private:
+    void _merge();
+};
+struct RayHit { // where TriangleBVH::intersect met the surface
+    int _face;
+    float _t; // in lengths of the ray direction
+    float _u, _v; // barycentric weights of the second and third corners
+};
+struct SurfacePoint { // TriangleBVH::closestPoint's answer
+    int _face;
+    glm::vec3 _point;
+    float _distance;
+};
+struct BVHNode {
+    glm::vec3 _lo;
+    int _first; // a leaf's block, or an inner node's first child. the second child follows it
+    glm::vec3 _hi;
+    int _count; // triangles in a leaf, 0 for inner nodes
+};
+struct TriangleBlock { // a leaf's triangles coordinate by coordinate, so one ray meets all four at once
+    float _v0[3][BVH_LEAF_SIZE];
+    float _e1[3][BVH_LEAF_SIZE]; // v1 - v0
+    float _e2[3][BVH_LEAF_SIZE]; // v2 - v0
+    int _face[BVH_LEAF_SIZE]; // -1 for empty lanes and hidden faces
+};
+class TriangleBVH { // binned SAH tree over the faces of an indexed triangle mesh, for picking and closest-point queries
+public:
+    TriangleBVH() : _nSlots(0) {}
+    void build(const std::vector<glm::vec3>& positions, const std::vector<int>& indices, const int& nFaces = -1); // faces past nFaces, and degenerate ones, are hidden. -1 shows them all
+    void refit(const std::vector<glm::vec3>& positions, const std::vector<int>& indices, const int& nFaces = -1); // new corners or positions for the same face slots. the tree keeps its shape
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit, const float& tMax = INFINITY) const; // the nearest hit, if any
+    bool closestPoint(const glm::vec3& p, SurfacePoint& closest, const float& maxDistance = INFINITY) const; // false if nothing is within maxDistance
+    bool empty() const { return _nodes.empty(); }
+    int nSlots() const { return _nSlots; } // faces of the mesh it was built for, hidden or not
+    int nNodes() const { return _nodes.size(); }
+    size_t nBytes() const { return sizeof(BVHNode) * _nodes.capacity() + sizeof(TriangleBlock) * _blocks.capacity() + sizeof(int) * _blockFaces.capacity(); }
+private:
+    std::vector<BVHNode> _nodes; // children always after their parent
+    std::vector<TriangleBlock> _blocks;
+    std::vector<int> _blockFaces; // every face slot of each block, hidden or not. -1 for empty lanes
+    int _nSlots;
+
+    void _fillLeaf(BVHNode& node, const std::vector<glm::vec3>& positions, const std::vector<int>& indices, const int& nFaces);
+};
+
+struct MeshSnapshot { // what a SimplifyWorker publishes for the render thread to draw
+    std::vector<glm::vec3> _positions;
+    std::vector<glm::vec3> _normals;
+    std::vector<glm::vec4> _colors;
+    std::vector<int> _indices; // the visible triangles only
+    int _nCollapses;
+};
+class SimplifyWorker { // quadricSimplify on a thread of its own. the mesh draws the published snapshots until the worker is done
+public:
+    SimplifyWorker() : _mesh(nullptr), _target(0), _nDone(0), _running(false), _cancel(false), _fresh(false), _front(0), _ready(1), _back(2), _publishSpacing(50) {}
+    bool start(MeshObject* mesh, const int& nCollapses, std::function<void(MeshObject*)> finish = nullptr); // false if a worker already has the mesh. finish runs on the worker unless cancelled
+    void cancel() { _cancel = true; } // stops after the collapse in progress
+    void join(); // wait for the thread and hand the mesh back. render thread only
+    bool running() { return _running; }
+    int nDone() { return _nDone; }
+    int target() { return _target; }
+    float progress() { return _target > 0 ? fmin(1, _nDone / (float)_target) : 1; }
+    bool swap(); // take the newest published snapshot. false if none came since the last swap. render thread only
+    const MeshSnapshot& front() { return _snapshots[_front]; }
+    void setPublishSpacing(const int& milliseconds) { _publishSpacing = milliseconds; }
+
+    ~SimplifyWorker() { cancel(); join(); }
+private:
+    MeshObject* _mesh;
+    std::thread _thread;
+    std::function<void(MeshObject*)> _finish;
+    int _target;
+    std::atomic<int> _nDone;
+    std::atomic<bool> _running;
+    std::atomic<bool> _cancel;
+    MeshSnapshot _snapshots[3]; // triple buffered, so neither side waits on the other for more than an index swap
+    std::mutex _swapMutex; // guards _ready and _fresh
+    bool _fresh; // _ready holds a snapshot the render thread has not seen
+    int _front, _ready, _back;
+    int _publishSpacing; // milliseconds between snapshots
+
+    void _run();
+    void _publish();
+};
+
 class MeshObject: public Object{
 public:
     MeshObject(std::string iFileName) : Object() {
+        _geomReady = false;
         _t = 1;
         _nCollapses = 0;
         _allowFins = false;
@@ -278,16 +612,60 @@ public:
         _oFileName = iFileName + "pm";
         _drawMode = 0;
         _customColors = false;
+        _streamingCollapses = false;
+        _recomputeCollapseNormals = true;
+        _checkpointBudget = 0;
+        _checkpointSpacing = 0;
+        _viewDependent = false;
+        _pixelTolerance = 1.0f;
+        _splitBudget = 1000;
+        _vertexArrayID = 0;
+        _positionBufferID = 0;
+        _normalBufferID = 0;
+        _colorBufferID = 0;
+        _triangleBufferID = 0;
+        _buffersReady = false;
+        _uploadedBytes = 0;
+        _uploadedBytesTotal = 0;
+        _quantizationCenter = glm::vec3(0, 0, 0);
+        _quantizationStep = 1;
+        _quantizationError = 0;
+        _shortIndices = false;
+        _verbose = true;
+        _guardTopology = false;
+        _worker = nullptr;
+        _snapshotIndexCount = 0;
+        _lodTarget = -1;
+        _lodBudget = 2000;
+        _morphFrames = 8;
+        _lodPhase = LOD_IDLE;
+        _lodFrame = 0;
+        _windowFrom = 0;
+        _windowTo = 0;
+        _windowNext = 0;
+        _windowSize = 256;
+        _applyFrames = 0;
+        _collapseError = -1;
+        _autoLOD = false;
+        _bvhDirty = true;
     }
     ~MeshObject() {
-        glBindVertexArray(0);
-        glDeleteVertexArrays(1, &_vertexArrayID);
+        if (_worker != nullptr) {
+            _worker->cancel();
+            _worker->join();
+        }
+        _deleteBuffers();
+        if (_collapseFile.is_open()) {
+            _collapseFile.close();
+            std::remove(_collapseFileName.c_str());
+        }
     }
     bool atCorner(const int& v);
     bool atBoundary(const int& v);
     float avgEdgeLength();
     bool isEdge(const int& v0, const int& v1);
     void doDraw();
+    GLuint vertexArray() { return _vertexArrayID; }
     int nCollapsablePairs() {
         if (_pairs.size() == 1) return 0;
         int count = 0;
@@ -313,11 +691,17 @@ public:
     int approximationMethod() { return _approximationMethod; }
     void setApproximationMethod(const int& approximationMethod) { _approximationMethod = approximationMethod; }
     void setT(const float& t);
+    void resetPairs(); // every edge a candidate pair again, as after loading
+    int nActiveVertices() { return _adjacency.size(); } // vertices some face still uses. cheap, unlike nVisibleVertices
+    void setVerbose(const bool& verbose) { _verbose = verbose; } // progress output while simplifying
+    void setGuardTopology(const bool& guard) { _guardTopology = guard; } // quadricSimplify passes over pairs that would pinch the surface or turn a face over. off, the collapses are the classic ones
+    bool guardTopology() { return _guardTopology; }
+    static void writeOFF(const std::string& oFileName, const std::vector<glm::vec3>& positions, const std::vector<int>& indices);
     std::string inFileName() { return _iFileName; }
     std::string outFileName() { return _oFileName; }
-    void setInFileName(const std::string& iFileName) { _iFileName = iFileName; _geomReady = false; }
+    void setInFileName(const std::string& iFileName) { _iFileName = iFileName; _geomReady = false; _boundsDirty = true; }
     void setOutFileName(const std::string& oFileName) { _oFileName = oFileName; }
-    void setVertexColor(const int& v, const glm::vec4& c) { _vertexColors[v] = c; }
+    void setVertexColor(const int& v, const glm::vec4& c) { _vertexColors[v] = c; _dirtyColors.add(v); }
 
     std::pair<int,int> randomEdge();
     glm::vec3 mergedCoordinates(const int& v0, const int& v1, const int& approximationMethod);
@@ -325,10 +709,37 @@ public:
     void collapse(const int& v0, const int& v1);
     void collapse(const int& v0, const int& v1, const int& approximationMethod);
     void collapseTo(const float& newComplexity);
+    void setTargetComplexity(const float& target); // doDraw approaches target a window of collapses at a time, geomorphing each window. collapseTo cancels it
+    float targetComplexity() { return _lodTarget < 0 ? _complexity : _lodTarget; }
+    int targetCollapseIndex() { return _lodTarget < 0 ? _collapseIndex() : _targetCollapseIndex(); }
+    void setTargetCollapseIndex(const int& collapseIndex) { setTargetComplexity(nVerticesCollapsed() + _collapses.size() - collapseIndex); }
+    int nFacesAt(const int& collapseIndex) { return _prefixFaces[collapseIndex]; } // triangles drawn with collapses [0, collapseIndex) applied. .offpm only
+    bool transitioning() { return _lodTarget >= 0; }
+    void finishWindow() { _finishTransition(); } // complete the window in flight at once, so the mesh sits at an LOD of its own. the transition carries on from there
+    void setLODBudget(const float& microseconds) { _lodBudget = microseconds; } // time a frame may spend changing topology for setTargetComplexity
+    void setMorphFrames(const int& nFrames) { _morphFrames = fmax(1, nFrames); } // frames each window takes to geomorph
+    const std::vector<float>& errorCurve() { return _errorCurve; } // [i] bounds how far the mesh with collapses [0, i) applied strays from the full one. never decreases
+    const std::vector<int>& errorHull() { return _errorHull; } // collapse indices on the lower convex hull of errorCurve against nFacesAt. what a World triangle budget weighs moves by
+    float selectComplexity(const glm::mat4& modelView, const glm::mat4& projection, const glm::vec4& viewport); // the least complexity whose error projects within the pixel tolerance
+    bool autoLOD() { return _autoLOD; }
+    void setAutoLOD(const bool& autoLOD) { _autoLOD = autoLOD && _format == "offpm"; } // doDraw targets selectComplexity every frame
+    void toggleAutoLOD() { setAutoLOD(!_autoLOD); }
+    void setCheckpointBudget(const size_t& bytes); // memory collapseTo may spend on snapshots to jump to instead of replaying every collapse
+    bool viewDependent() { return _viewDependent; }
+    void setViewDependent(const bool& viewDependent);
+    void toggleViewDependent() { setViewDependent(!_viewDependent); }
+    void setPixelTolerance(const float& pixelTolerance) { _pixelTolerance = pixelTolerance; } // for refineView and selectComplexity
+    float pixelTolerance() { return _pixelTolerance; }
+    void setSplitBudget(const int& splitBudget) { _splitBudget = splitBudget; }
+    void refineView(const glm::mat4& modelView, const glm::mat4& projection, const glm::vec4& viewport); // split/collapse records against the view. called by doDraw
     void collapseRandomEdge(const int& approximationMethod = MIDPOINT_APPROXIMATION_METHOD);
 
     void makeProgressiveMeshFile();
+    void makeSimplifiedMeshFile(const std::string& oFileName); // the current LOD as a plain .off, cache and fetch optimized
+    void makeLODFiles(const std::vector<float>& thresholds, const int& thresholdType = LOD_BY_VERTEX_FRACTION, const bool& sharedVertices = false); // one simplify pass, snapshotting a level at each threshold
 
+    void streamCollapses() { _streamingCollapses = true; } // spill collapse records to disk as they are made instead of keeping them in memory
+    void storeCollapseNormals() { _recomputeCollapseNormals = false; } // keep the .offpm normals in memory instead of recomputing them in collapseTo
     void allowFins() { _allowFins = true; }
     void disallowFins() { _allowFins = false; }
     float faceArea(const int& f);
@@ -340,13 +751,20 @@ public:
     std::pair<glm::vec3,float> metric(const int& v0, const int& v1);
 
     void updateQuadricsAndMetrics(const int& v0, const int& v1, const std::set<int>& vShared); // updates _pairs ASSUMING THAT THE _PAIRS.TOP() was collapsed.
-    void quadricSimplify();
+    bool quadricSimplify(); // one collapse. false once no pairs are left
+    float nextCollapseError(); // the metric of the pair quadricSimplify would collapse next. INFINITY if none are left
 
     void reComputeVertexNormals();
     void reComputeFaceNormals();
-    void readGeom();
-    void readGeomOFF(); // read full data
+    void readGeom(const bool& prepare = true); // prepare false stops an .off once parsed. reComputeVertexNormals, reComputeQuadrics and resetPairs then ready it for simplifying
+    void readGeomOFF(const bool& prepare = true); // read full data
     void readGeomOFFPM(); // read progressive mesh
+    void setGeom(const std::vector<glm::vec3>& positions, const std::vector<int>& indices); // a .off mesh from memory, for simplifying pieces of other meshes
+    void lockVertex(const int& v) { _locked[v] = true; } // quadricSimplify will not move or remove v. needs setGeom
+    const std::vector<glm::vec3>& vertexPositions() { return _vertexPositions; }
+    const std::vector<int>& triangleIndices() { return _triangleIndices; } // three a face slot. only visibleFaces() are meaningful
+    const TriangleBVH& bvh(); // over the visible faces. built on first use, refit once the mesh changes
+    int pickVertex(const glm::vec3& origin, const glm::vec3& direction); // the corner of the first visible face the ray hits nearest the hit, -1 if it misses. model coordinates
 
     float xMin() { return _xMin; }
     float xMax() { return _xMax; }
@@ -354,6 +772,12 @@ public:
     float yMax() { return _yMax; }
     float zMin() { return _zMin; }
     float zMax() { return _zMax; }
+    bool localBounds(glm::vec3& lo, glm::vec3& hi) {
+        if (_geomReady == false) return false; // drawn once to load, then culled
+        lo = glm::vec3(_xMin, _yMin, _zMin);
+        hi = glm::vec3(_xMax, _yMax, _zMax);
+        return true;
+    }
     int nVertices() { return _dummy.size(); }
     int nVerticesCollapsed() { return _dummyCollapsed.size(); }
     int nFaces() { return _faces.size(); }
@@ -364,9 +788,15 @@ public:
     void toggleDrawMode() { _drawMode = (_drawMode + 1) % 2; }
     bool customColors() { return _customColors; }
     void toggleCustomColors() { _customColors = !_customColors; }
+    size_t uploadedBytes() { return _uploadedBytes; } // bytes sent to the GPU by the last doDraw
+    size_t uploadedBytesTotal() { return _uploadedBytesTotal; } // and by every doDraw so far
+    float quantizationError() { return _quantizationError; } // largest distance between a position and what the GPU got for it
+    bool shortIndices() { return _shortIndices; } // 16-bit index buffers
     std::map<int, std::set<int>> adjacency() { return _adjacency; }
     std::set<int> adjacency(const int& v) { return _adjacency[v]; }
     void makeAdjacencyFromIndices();
+    bool simplifying(); // a SimplifyWorker owns the topology. nothing but doDraw may touch the mesh until this is false
+    void snapshot(MeshSnapshot& out); // copy out what doDraw needs
 
     std::pair<std::vector<glm::vec3>,std::vector<glm::vec4>> vRedundant() {
         std::vector<glm::vec3> out;
@@ -401,6 +831,8 @@ protected:
     bool _vertexNormalsReady;
     bool _aggressiveSimplification;
     bool _customColors;
+    bool _verbose; // progress output while reading and simplifying
+    bool _guardTopology;
     int _drawMode; // 0 for wire, 1 for filled triangles
 
     int _nCollapses;
@@ -411,45 +843,401 @@ protected:
 
     std::map<int, std::set<int>> _adjacency;
     GLuint _vertexArrayID;
+    GLuint _positionBufferID;
+    GLuint _normalBufferID;
+    GLuint _colorBufferID;
+    GLuint _triangleBufferID;
+    bool _buffersReady; // the buffers match the sizes of the arrays below. cleared whenever the arrays are reallocated
+    DirtyRanges _dirtyPositions; // what doDraw still has to upload, in array elements
+    DirtyRanges _dirtyNormals;
+    DirtyRanges _dirtyColors;
+    DirtyRanges _dirtyTriangles;
+    TriangleBVH _bvh;
+    bool _bvhDirty; // set with the dirty ranges, so bvh() knows to refit
+    size_t _uploadedBytes;
+    size_t _uploadedBytesTotal;
+    glm::vec3 _quantizationCenter; // the GPU gets positions as snorm16 steps from here, doDraw scales them back
+    float _quantizationStep;
+    float _quantizationError;
+    bool _shortIndices; // every vertex fits in an unsigned short
+    SimplifyWorker* _worker;
+    int _snapshotIndexCount; // indices of the last snapshot uploaded
 
     std::vector<glm::vec3> _vertexPositions; // these are for feeding into the vertex, normal, index buffers
-    std::vector<glm::vec3> _vertexNormals; // we duplicate it for drawing the normals
+    std::vector<glm::vec3> _vertexNormals;
     std::vector<glm::vec4> _vertexColors;
     std::vector<Face> _faces;
     std::vector<glm::vec3> _faceNormals;
     std::vector<float> _faceAreas;
     std::vector<int> _triangleIndices;
-    std::vector<int> _lineIndices;
 
     float _t; // the distance threshold for quadric simplification
     std::vector<glm::mat4> _quadrics;
     reservable_priority_queue<Edge> _pairs;
     std::vector<int> _lastUpdate;
     std::vector<std::set<int>> _partners;
+    std::vector<bool> _locked; // empty unless setGeom made the mesh
 
     ////////////////////////////////////////
     ///// STUFF FOR PROGRESSIVE MESHES /////
     ////////////////////////////////////////
-    std::vector<int> _v0;
-    std::vector<int> _v1;
-    std::vector<glm::vec3> _n0;
-    std::vector<glm::vec3> _n1;
-    std::vector<glm::vec3> _n;
-    std::vector<glm::vec3> _xyz0; // coordinates of v0 before collapse
-    std::vector<glm::vec3> _xyz1; // coordinates of v1 before collapse
-    std::vector<glm::vec3> _xyz;  // coordinates of merge(v0,v1) after collapse (REPLACES xyz0)
-    std::vector<std::vector<int>> _fVec1;
-    std::vector<std::vector<int>> _fVec;
-    std::vector<std::vector<int>> _fVecR; // shared faces to remove
-    std::vector<std::vector<std::vector<int>>> _fVecRijk;
+    std::vector<Collapse> _collapses;
+    std::vector<int> _collapseFaces; // face index pool for _collapses
+    std::vector<glm::vec3> _collapseNormals; // n0, n1, n for each collapse. empty for .offpm meshes that recompute normals
+    bool _recomputeCollapseNormals;
+    size_t _checkpointBudget;
+    int _checkpointSpacing; // collapses between consecutive checkpoints
+    std::vector<Checkpoint> _checkpoints; // _checkpoints[j] is at collapse index _collapses.size() - j*_checkpointSpacing
+    std::vector<int> _prefixVertices; // live vertices and faces with collapses [0, i) applied. see _makePrefixOrder
+    std::vector<int> _prefixFaces;
+
+    bool _viewDependent; // collapses are applied one at a time by refineView instead of as a prefix by collapseTo
+    float _pixelTolerance; // projected error a region may have before it is split
+    int _splitBudget; // splits refineView may make per frame
+    std::vector<CollapseNode> _nodes;
+    std::vector<int> _faceRecordsOffset; // the collapses touching face f, in order, are _faceRecords[_faceRecordsOffset[f].._faceRecordsOffset[f+1])
+    std::vector<int> _faceRecords;
+    std::vector<int> _faceRecordCursor; // how many of face f's collapses are applied. they are always a prefix of its list
+    std::vector<bool> _applied;
+    std::vector<int> _front; // collapses that can currently be split or collapsed
+    std::vector<bool> _onFront;
+
+    float _lodTarget; // -1 unless setTargetComplexity is still working toward it
+    float _lodBudget; // microseconds
+    int _morphFrames;
+    int _lodPhase;
+    int _lodFrame; // frames into the current morph
+    int _windowFrom; // the window runs from collapse index _windowFrom to _windowTo, either way
+    int _windowTo;
+    int _windowNext; // the next collapse or split to apply
+    int _windowSize; // collapses per window. grows while windows apply within a frame, shrinks when they take longer than a morph
+    int _applyFrames; // frames the current window has spent applying
+    std::vector<int> _morphVertices; // every vertex of the window collapses
+    std::vector<glm::vec3> _morphFine; // where they are with the window split
+    std::vector<glm::vec3> _morphCoarse; // where they are with the window collapsed, at the vertex they merge into
+    std::vector<glm::vec3> _morphOut;
+    std::vector<int> _morphSlot; // vertex -> index in the arrays above while a window is built, -1 otherwise
+    float _collapseError; // recorded with the collapses being made. quadricSimplify sets it around each collapse
+    std::vector<float> _errorCurve;
+    std::vector<int> _errorHull;
+    bool _autoLOD;
+
+    bool _streamingCollapses;
+    std::string _collapseFileName;
+    std::ofstream _collapseFile; // collapse records already written out, in the order they were made
+    std::vector<char> _collapseFileBuffer;
 
     std::vector<bool> _dummyCollapsed;
     std::vector<bool> _dummy;
 
     float _complexity; // the current number of vertices
+
+    bool _collapse(const int& v0, const int& v1, const int& approximationMethod, std::vector<int>& vFinVec); // a single collapse without fin removal. vFinVec gets the fin candidates
+    bool _isFin(const int& v0, const int& vFin);
+    bool _flipsFace(const int& v0, const int& v1, const glm::vec3& position); // would moving both to position turn over a face that survives the collapse
+    bool _keepsManifold(const int& v0, const int& v1); // the link condition: the only neighbors they share are corners of their shared faces
+    bool _isLocked(const int& v) { return _locked.size() > 0 && _locked[v]; }
+    bool _isCollapsible(const Edge& e) { return e._c0 == _lastUpdate[e._u0] && e._c1 == _lastUpdate[e._u1] && !_isLocked(e._u0) && !_isLocked(e._u1); } // up to date and free to move
+    void _createBuffers();
+    void _allocateBuffers(const int& nVertices, const int& nIndices); // a vertex array and empty buffers of these sizes
+    void _deleteBuffers();
+    void _uploadBuffers(); // glBufferSubData the dirty ranges
+    void _uploadIndices(const GLuint& bufferID, const std::vector<int>& indices, DirtyRanges& dirty);
+    void _drawBuffers(const int& nIndices, const int& nVertices); // the first nIndices indices. nVertices bounds them, 0 if unknown
+    void _uploadSnapshot(const MeshSnapshot& snapshot); // all of it, requantized. leaves the live buffers to be recreated
+    void _drawNormals(); // a line per vertex into the line batch, as long as the square root of its average face area
+    void _fitQuantization() { _fitQuantization(_vertexPositions, _collapses.size()); } // a cube around every position the mesh can take
+    void _fitQuantization(const std::vector<glm::vec3>& positions, const int& nCollapses); // around positions and the first nCollapses collapse positions
+    bool _packPositions(const int& begin, const int& end, std::vector<glm::i16vec4>& packed); // appends. false if a position fell outside the cube
+    int _indexSize() { return _shortIndices == true ? sizeof(unsigned short) : sizeof(int); }
+    GLenum _indexType() { return _shortIndices == true ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
+    void _markVertexDirty(const int& v) { _dirtyPositions.add(v); _dirtyNormals.add(v); _bvhDirty = true; }
+    void _markFaceDirty(const int& f) { _dirtyTriangles.add(3 * f, 3 * f + 3); _bvhDirty = true; }
+    const int* _fVec1(const Collapse& c) { return _collapseFaces.data() + c._f; }
+    const int* _fVecR(const Collapse& c) { return _collapseFaces.data() + c._f + c._nF1; }
+    const int* _fVecRijk(const Collapse& c) { return _collapseFaces.data() + c._f + c._nF1 + c._nFR; }
+    const int* _fVec(const Collapse& c) { return _collapseFaces.data() + c._f + c._nF1 + 4 * c._nFR; }
+    glm::vec3 _faceNormalSum(const int& v, const int* f, const int& nF); // sum of the unit normals of the faces in f that touch v
+    void _writeCollapse(std::ostream& oFile, const int& i);
+    std::vector<int> _optimizedIndices(); // the visible triangles in vertex cache order, still indexing _vertexPositions
+    void _streamCollapses();
+    void _applyCollapse(const int& i); // redo collapse i on the index buffer
+    void _applySplit(const int& i); // undo collapse i on the index buffer
+    void _makePrefixOrder(const std::vector<int>& vBase, const std::vector<int>& fBase); // renumber a freshly read .offpm so every LOD is a prefix
+    int _collapseIndex() { return fmin(fmax(0, (float)(nVerticesCollapsed() + _collapses.size()) - _complexity), _collapses.size()); } // collapses [0, index) are applied
+    void _buildCheckpoints();
+    void _buildHierarchy();
+    bool _canCollapse(const int& i);
+    int _splitBlocker(const int& i); // a later collapse that must be split before i can be
+    void _viewCollapse(const int& i);
+    void _viewSplit(const int& i);
+    bool _isActiveNode(const int& i) { return _applied[i] && (_nodes[i]._parent < 0 || !_applied[_nodes[i]._parent]); }
+    void _touchFront(const int& i);
+    void _seekCheckpoint(const float& newComplexity);
+    int _targetCollapseIndex() { return fmin(fmax(0, (float)(nVerticesCollapsed() + _collapses.size()) - _lodTarget), _collapses.size()); }
+    void _updateLOD(); // one frame of setTargetComplexity. called by doDraw
+    void _openWindow(); // the next window toward the target, with the fine and coarse positions of its vertices
+    bool _applyWindow(const std::chrono::high_resolution_clock::time_point& deadline); // false if the deadline came first
+    void _morph(const float& alpha); // 0 puts the window vertices at their fine positions, 1 at their coarse ones
+    void _finishTransition(); // complete the current window at once, leaving a mesh collapseTo can work from
+    void _buildErrorCurve();
+
+    friend class SimplifyWorker;
+    friend class ProgressiveMesh;
+};
+
+class ProgressiveMesh { // the read-only part of a .offpm, shared by every MeshInstance drawing it. safe to read from any thread once made
+public:
+    static std::shared_ptr<const ProgressiveMesh> load(const std::string& fileName, MeshObject* source = nullptr); // one copy per file for as long as anything holds it. nullptr if not a .offpm. source, a MeshObject holding the file, is replayed rather than read again
+    ProgressiveMesh(MeshObject* source); // from a .offpm MeshObject at any LOD. replays every collapse on it, leaving it at the base mesh
+    int nVersions() const { return _positions.size(); }
+    int nCollapses() const { return _from.size() / 2; }
+    int nFaces() const { return _baseIndices.size() / 3; }
+    int nFacesAt(const int& collapseIndex) const { return _prefixFaces[collapseIndex]; } // faces [0, n) are drawn with collapses [0, collapseIndex) applied
+    float complexityAt(const int& collapseIndex) const { return _nBase + nCollapses() - collapseIndex; } // vertices, as MeshObject::complexity counts them
+    int collapseIndexAt(const float& complexity) const { return fmin(fmax(0, _nBase + nCollapses() - complexity), nCollapses()); }
+    const std::vector<int>& baseIndices() const { return _baseIndices; }
+    const std::vector<float>& errorCurve() const { return _errorCurve; } // as MeshObject::errorCurve
+    const std::vector<int>& errorHull() const { return _errorHull; }
+    const glm::vec3& position(const int& version) const { return _positions[version]; }
+    const glm::vec3& normal(const int& version) const { return _normals[version]; }
+    int version(const int& i) const { return _nFull + i; } // the vertex collapse i makes
+    const int* from(const int& i) const { return &_from[2 * i]; } // the two versions collapse i merges
+    const int* corners(const int& i) const { return &_corners[_cornerOffset[i]]; } // index buffer entries collapse i sets to version(i)
+    const int* cornersFrom(const int& i) const { return &_cornersFrom[_cornerOffset[i]]; } // what they hold before it
+    int nCorners(const int& i) const { return _cornerOffset[i + 1] - _cornerOffset[i]; }
+    void bounds(glm::vec3& lo, glm::vec3& hi) const { lo = _lo; hi = _hi; }
+    bool shortIndices() const { return nVersions() <= 65536; }
+    void bindBuffers() const; // point the vertex arrays at the shared buffers, uploading them the first time. render thread only
+    const glm::vec3& quantizationCenter() const { return _quantizationCenter; }
+    float quantizationStep() const { return _quantizationStep; }
+    size_t nBytes() const; // CPU memory held
+
+    ~ProgressiveMesh(); // the last holder should let go on the render thread, which owns the buffers
+private:
+    int _nFull; // vertices of the full mesh. they are versions [0, _nFull)
+    int _nBase; // vertices of the base mesh
+    std::vector<glm::vec3> _positions; // every vertex the mesh ever has: the full mesh, then the one each collapse makes
+    std::vector<glm::vec3> _normals;
+    std::vector<int> _baseIndices; // all faces in prefix order, in versions, with every collapse applied. faces past the prefix keep their corners from when they were removed
+    std::vector<int> _from;
+    std::vector<int> _cornerOffset;
+    std::vector<int> _corners;
+    std::vector<int> _cornersFrom;
+    std::vector<int> _prefixFaces;
+    std::vector<float> _errorCurve;
+    std::vector<int> _errorHull;
+    glm::vec3 _lo, _hi; // around every version
+    glm::vec3 _quantizationCenter;
+    float _quantizationStep;
+    mutable GLuint _positionBufferID; // made on first use
+    mutable GLuint _normalBufferID;
+};
+
+class MeshInstance : public Object { // a ProgressiveMesh drawn at a LOD of its own. holds only its index buffer and the geomorph in flight
+public:
+    MeshInstance(std::shared_ptr<const ProgressiveMesh> mesh);
+    void doDraw();
+    GLuint vertexArray() { return _vertexArrayID; }
+    bool localBounds(glm::vec3& lo, glm::vec3& hi) { _mesh->bounds(lo, hi); return true; }
+    const ProgressiveMesh& mesh() { return *_mesh; }
+    float complexity() { return _mesh->complexityAt(_collapseIndex); }
+    void collapseTo(const float& complexity); // at once, dropping any transition
+    void setTargetComplexity(const float& complexity); // geomorphed a window at a time over the next frames, as MeshObject::setTargetComplexity
+    float targetComplexity() { return _mesh->complexityAt(_lodTarget < 0 ? _collapseIndex : _lodTarget); }
+    bool transitioning() { return _lodTarget >= 0; }
+    void setMorphFrames(const int& nFrames) { _morphFrames = fmax(1, nFrames); }
+    size_t nBytes(); // CPU memory this instance adds to its mesh
+    int collapseIndex() { return _collapseIndex; }
+    const std::vector<int>& indices() { return _indices; } // versions of mesh(). faces [0, mesh().nFacesAt(collapseIndex())) are drawn
+
+    ~MeshInstance();
+private:
+    std::shared_ptr<const ProgressiveMesh> _mesh;
+    int _collapseIndex; // collapses [0, _collapseIndex) are in _indices
+    std::vector<int> _indices; // versions of the shared mesh
+    DirtyRanges _dirtyIndices;
+    GLuint _vertexArrayID;
+    GLuint _indexBufferID;
+
+    int _lodTarget; // collapse index, -1 unless setTargetComplexity is still working toward it
+    int _morphFrames;
+    int _lodFrame;
+    int _windowSize; // collapses per window
+    int _windowFrom; // collapses [_windowFrom, _windowTo) morph, the finer end in _indices meanwhile
+    int _windowTo;
+    bool _collapsing;
+    std::vector<int> _morphFaces; // faces drawn from the morph buffers instead, left degenerate in _indices
+    std::vector<int> _morphSaved; // their real corners
+    std::vector<glm::vec3> _morphFine; // positions and normals of the morph vertices at the fine end of the window, then at the coarse end
+    std::vector<glm::vec3> _morphCoarse;
+    std::vector<glm::vec3> _morphFineNormals;
+    std::vector<glm::vec3> _morphCoarseNormals;
+    std::vector<int> _morphIndices;
+    std::vector<glm::vec3> _morphOut; // scratch for the blended positions then normals
+    GLuint _morphArrayID;
+    GLuint _morphPositionBufferID;
+    GLuint _morphNormalBufferID;
+    GLuint _morphIndexBufferID;
+
+    void _apply(const int& collapseIndex); // rewrite _indices to collapseIndex
+    void _updateLOD();
+    void _openWindow(const int& from, const int& to); // build the morph buffers for collapses [from, to) with _indices at from
+    void _closeWindow();
+    void _drawMorph(const float& alpha); // 0 at the fine end, 1 at the coarse end
+};
+
+struct InstanceData { // one copy's entry in an InstancedMesh's per-instance buffer
+    glm::mat4 _transform;
+    glm::u8vec4 _color;
+};
+class InstancedMesh : public Object { // many copies of one ProgressiveMesh. the copies in a LOD bucket go out with one glDrawElementsInstanced
+public:
+    InstancedMesh(std::shared_ptr<const ProgressiveMesh> mesh, const int& nBuckets = 6); // bucket b has about 1/2^b of the full vertices
+    int add(const glm::mat4& transform, const glm::vec4& color = glm::vec4(1, 1, 1, 1)); // in this object's model coordinates. returns the copy's index
+    void set(const int& i, const glm::mat4& transform, const glm::vec4& color);
+    void clear();
+    int size() { return _transforms.size(); }
+    int nBuckets() { return _bucketIndex.size(); }
+    float bucketComplexity(const int& b) { return _mesh->complexityAt(_bucketIndex[b]); }
+    int bucketSize(const int& b) { return _bucketCount[b]; } // copies the last doDraw drew from bucket b
+    int nCulled() { return _nCulled; }
+    int nDrawCalls() { return _nDrawCalls; }
+    double submitTime() { return _submitTime; } // microseconds of CPU the last doDraw took
+    void setPixelTolerance(const float& pixelTolerance) { _pixelTolerance = pixelTolerance; } // each copy gets the coarsest bucket whose error projects within it
+    void setInstancing(const bool& instancing) { _instancing = instancing; } // false draws every copy on its own, as separate objects would. forced off without GL 3.3 or when the instancing shader fails
+    bool instancing() { return _instancing; }
+    void doDraw();
+    GLuint vertexArray() { return _vertexArrayID; }
+    bool localBounds(glm::vec3& lo, glm::vec3& hi); // around every copy
+
+    ~InstancedMesh();
+private:
+    std::shared_ptr<const ProgressiveMesh> _mesh;
+    std::vector<glm::mat4> _transforms;
+    std::vector<glm::u8vec4> _colors;
+    std::vector<glm::vec3> _centers; // bounding sphere of each copy
+    std::vector<float> _radii;
+    std::vector<float> _scales; // how much each transform enlarges the mesh's error
+    std::vector<int> _bucketIndex; // collapse index of each bucket, finest first
+    std::vector<GLuint> _bucketBufferIDs;
+    std::vector<int> _bucketCount;
+    std::vector<int> _bucketStart;
+    std::vector<int> _instanceBucket; // this frame's bucket of each copy, -1 if culled
+    std::vector<InstanceData> _instanceData; // this frame's copies, bucket by bucket
+    GLuint _vertexArrayID;
+    GLuint _instanceBufferID;
+    Shader * _shader;
+    GLint _matrixLocation; // the first of four columns
+    GLint _colorLocation;
+    GLint _centerLocation;
+    GLint _stepLocation;
+    float _pixelTolerance;
+    bool _instancing;
+    int _nCulled;
+    int _nDrawCalls;
+    double _submitTime;
+
+    void _createBuffers();
+    void _pointInstances(const int& start); // aim the per-instance attributes at _instanceData[start]
+};
+
+struct Cluster { // about 128 triangles of a ClusterDAG
+    std::vector<int> _indices; // triangle list into ClusterDAG::positions()
+    glm::vec3 _center; // bounds and error of the group this cluster was simplified from, or its own bounds and 0 at the leaves.
+    float _radius; // every cluster from one group shares them, so they all switch in together
+    float _error;
+    glm::vec3 _parentCenter; // bounds and error of the group this cluster was merged into. shared by the whole group
+    float _parentRadius;
+    float _parentError; // INFINITY for roots
+    int _level; // 0 at the leaves
+    int _group; // the group that made this cluster, -1 at the leaves
+    int _parentGroup; // the group this cluster was simplified in, -1 for roots
+};
+struct ClusterGroup { // neighboring clusters simplified together with their outer border locked
+    std::vector<int> _children; // clusters that went in
+    std::vector<int> _parents; // clusters that came out
+    glm::vec3 _center; // encloses the bounds of all the children
+    float _radius;
+    float _error; // the largest child error plus how far the simplified surface strays from the children
+};
+class ClusterDAG { // hierarchical LOD for big meshes. selectCut picks clusters of different levels without cracks between them
+public:
+    ClusterDAG() {
+        _clusterSize = 128;
+        _groupSize = 4;
+        _nThreads = fmax(1, std::thread::hardware_concurrency());
+        _nLevels = 0;
+    }
+    void setClusterSize(const int& clusterSize) { _clusterSize = clusterSize; }
+    void setGroupSize(const int& groupSize) { _groupSize = groupSize; }
+    void setThreads(const int& nThreads) { _nThreads = nThreads; }
+    void build(MeshObject* mesh); // from the visible faces of mesh
+    void build(const std::vector<glm::vec3>& positions, const std::vector<int>& indices);
+    std::vector<int> selectCut(const glm::mat4& modelView, const glm::mat4& projection, const glm::vec4& viewport, const float& pixelTolerance);
+    std::vector<int> cutIndices(const std::vector<int>& cut); // the triangles of the clusters in cut
+    const std::vector<glm::vec3>& positions() { return _positions; }
+    const Cluster& cluster(const int& i) { return _clusters[i]; }
+    const ClusterGroup& group(const int& g) { return _groups[g]; }
+    int nClusters() { return _clusters.size(); }
+    int nGroups() { return _groups.size(); }
+    int nLevels() { return _nLevels; }
+protected:
+    int _clusterSize; // triangles per cluster, give or take merged slivers
+    int _groupSize; // a group is filled up to _groupSize full clusters worth of triangles
+    int _nThreads;
+    int _nLevels;
+    std::vector<glm::vec3> _positions; // shared by all levels. simplification appends the vertices it moves
+    std::vector<Cluster> _clusters;
+    std::vector<ClusterGroup> _groups;
+
+    std::vector<std::vector<int>> _partition(const std::vector<int>& indices); // split a triangle list into edge-connected runs of about _clusterSize triangles
+    std::vector<std::vector<int>> _makeGroups(const std::vector<int>& level); // gather clusters of a level by shared border edges
+    int _addCluster(const std::vector<int>& indices, const int& level, const int& group); // bounds from the triangles, no error
+    float _projectedError(const float& error, const glm::vec3& center, const float& radius, const glm::mat4& modelView, const float& kappa);
+};
+
+struct SurfaceError { // distances between a measured surface and a reference, in their model units
+    float _maxForward; // one-sided Hausdorff distance: the farthest a sample of the measured surface is from the reference
+    float _maxBackward; // the farthest a sample of the reference is from the measured surface
+    float _rmsForward;
+    float _rmsBackward;
+    int _nFaces; // visible faces of the measured surface. 0 if the reference has none either
+    bool empty() const { return _nFaces == 0; } // nothing to measure, so the distances are 0 and mean nothing
+    float hausdorff() const { return fmax(_maxForward, _maxBackward); }
+    float rms() const { return fmax(_rmsForward, _rmsBackward); } // symmetric, as Metro reports it
+};
+class ErrorMeter { // Cignoni et al., "Metro: measuring error on simplified surfaces" (1998). sampled both ways through BVH closest-point queries
+public:
+    ErrorMeter(MeshObject* reference, const int& nSamples = 50000); // copies the visible faces of reference at its current LOD
+    SurfaceError measure(MeshObject* mesh); // mesh at its current LOD against the reference. same model coordinates. finishes a window mesh is morphing first
+    void measureCurve(MeshObject* mesh, const int& nPoints, std::vector<float>& complexities, std::vector<SurfaceError>& errors); // .offpm. nPoints LODs from full to base, spaced geometrically. leaves mesh where it was
+    void setThreads(const int& nThreads) { _nThreads = nThreads; }
+    int nSamples() { return _nSamples; } // area samples a side. the vertices are sampled too
+    double measureTime() { return _measureTime; } // ms the last measure took
+private:
+    std::vector<glm::vec3> _positions;
+    std::vector<int> _indices; // the reference's visible faces only
+    TriangleBVH _bvh;
+    std::vector<glm::vec3> _samples; // on the reference, the same for every measure
+    int _nSamples;
+    int _nThreads;
+    double _measureTime;
+
+    void _sample(const std::vector<glm::vec3>& positions, const std::vector<int>& indices, const std::vector<int>& faces, std::vector<glm::vec3>& samples); // the faces' vertices, then _nSamples points spread by area
+    void _distances(const std::vector<glm::vec3>& samples, const TriangleBVH& bvh, float& maxDistance, float& rmsDistance); // over _nThreads threads
 };
 
+// Index buffer optimization for meshes we write out. Indices are triangle lists.
+void optimizeVertexCache(std::vector<int>& indices, const int& nVertices); // Forsyth's linear-speed vertex cache reordering of the triangles
+std::vector<int> optimizeVertexFetch(std::vector<int>& indices, const int& nVertices); // renumber vertices in order of first use. returns old -> new
+std::pair<float,float> vertexCacheStats(const std::vector<int>& indices, const int& cacheSize = 16); // ACMR and ATVR of a FIFO post-transform cache
 
+// Packed vertex attributes for the GPU copies of a mesh, 16 bytes a vertex instead of 40. All of them decode in the fixed pipeline
+glm::i16vec4 quantizePosition(const glm::vec3& p, const glm::vec3& center, const float& step); // steps of step from center. w is padding
+glm::vec3 dequantizePosition(const glm::i16vec4& q, const glm::vec3& center, const float& step);
+glm::i8vec4 packNormal(const glm::vec3& n); // snorm8. w is padding
+glm::u8vec4 packColor(const glm::vec4& c); // unorm8
 
 }
 
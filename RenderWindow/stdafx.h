@@ -11,12 +11,14 @@
     #include <Windows.h>
 #endif
 #include <stdio.h>
+#include <cassert>
 #include <tchar.h>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <array>
 #include <tuple>
 #include <unordered_map>
 #include <string>
@@ -26,6 +28,14 @@
 #include <set>
 #include <list>
 #include <queue>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <random>
+#include <xmmintrin.h>
 
 //#define _USE_MATH_DEFINES
 //#include <math.h>
@@ -34,3 +44,5 @@
 #include <GL/glew.h>
 #include <GL/glut.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <glm/gtc/matrix_transform.hpp>